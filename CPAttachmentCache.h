@@ -0,0 +1,80 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPAttachmentCache.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPAttachmentCache and CPLazyAttachmentCell classes.  See
+ "CPAttachmentCache.m" for info on the CPAttachmentCache class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+@class CPAttachmentCache;
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+// Draws a picture that's only decoded when it's on the screen
+
+@interface CPLazyAttachmentCell : NSTextAttachmentCell
+{
+    CPAttachmentCache *cache;  // Retained, so it's around as long as we are
+    NSSize size;  // Taken from the original cell, so layout never decodes anything
+    
+@public  // Only the cache touches these (with its lock held)
+
+    unsigned fileLength;  // How big the picture file is
+    
+    // Only while the picture is decoded
+    
+    NSImage *decodedImage;
+    unsigned cost;  // How much memory it takes up
+    CPLazyAttachmentCell *newer;  // The cache's list, most recently drawn first
+    CPLazyAttachmentCell *older;
+}
+
+- (id)initWithCache:(CPAttachmentCache *)aCache size:(NSSize)aSize;
+
+@end
+
+// Keeps a document's decoded pictures under a memory limit
+
+@interface CPAttachmentCache : NSObject
+{
+    NSLock *lock;  // Cells can be let go of on worker threads (in snapshots)
+    CPLazyAttachmentCell *newest;
+    CPLazyAttachmentCell *oldest;
+    
+    unsigned limit;  // In bytes
+    unsigned long usedBytes;  // By decoded pictures
+    unsigned loadedCount;
+    
+    // Everything we've taken over
+    
+    unsigned attachmentCount;
+    unsigned long fileBytes;
+}
+
+- (id)initWithMemoryLimit:(unsigned)bytes;
+
+// Taking over the attachments in newly loaded text
+
+- (unsigned)adoptAttachmentsInText:(NSAttributedString *)text;  // Returns how many it took over
+
+// Used by the cells
+
+- (NSImage *)imageForCell:(CPLazyAttachmentCell *)cell;
+- (void)forgetCell:(CPLazyAttachmentCell *)cell;
+
+// The memory report
+
+- (unsigned)memoryLimit;
+- (unsigned long)usedBytes;  // Decoded pictures
+- (unsigned)loadedCount;
+- (unsigned)attachmentCount;
+- (unsigned long)fileBytes;  // The (memory mapped) picture files
+
+@end
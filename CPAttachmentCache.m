@@ -0,0 +1,385 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPAttachmentCache.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Keeps the pictures in CPD and RTFD documents from all being in memory at
+ the same time.
+ 
+ When AppKit reads an RTFD, every picture gets a cell with its own image,
+ and every image is decoded the first time it's drawn -- and then it stays
+ decoded for as long as the document is open.  A document with hundreds of
+ photos ends up holding all of them, fully decoded, even though only a
+ couple are ever on the screen at once.
+ 
+ So after a document is loaded, the cache takes over its pictures.  Each
+ one gets a CPLazyAttachmentCell, which remembers how big the picture is
+ (so the text can be laid out without looking at it), and only asks the
+ cache for the image when it's actually drawn.  The cache decodes it right
+ out of the attachment's file wrapper (which, for RTFD packages, is the
+ memory mapped file) and keeps it in a list, most recently drawn first.
+ When the decoded pictures take up more than the limit, the ones at the
+ end of the list are thrown out, and get decoded again if they're scrolled
+ back onto the screen.
+ 
+ The file wrappers themselves are never touched, so saving writes the
+ original picture files back out exactly the way they were, without
+ decoding and encoding them again.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ 
+ */
+
+#import "CPAttachmentCache.h"
+
+
+@implementation CPLazyAttachmentCell
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+- (id)initWithCache:(CPAttachmentCache *)aCache size:(NSSize)aSize
+{
+    if (self = [super init])
+    {
+        cache = [aCache retain];
+        size = aSize;
+    }
+    
+    return self;
+}
+
+/****************/
+/* Cell methods */
+/****************/
+
+/***** How much room do we need? *****/
+
+// This is what layout asks for, so it can't decode the picture
+
+- (NSSize)cellSize
+{
+    return size;
+}
+
+/***** The picture *****/
+
+/*
+ * NSTextAttachmentCell draws (and drags) whatever this returns,
+ * so this is the only place a picture is ever decoded.
+ */
+
+- (NSImage *)image
+{
+    return [cache imageForCell:self];
+}
+
+/***** Clean up *****/
+
+- (void)dealloc
+{
+    [cache forgetCell:self];  // Lets go of the picture too
+    [cache release];
+    
+    [super dealloc];
+}
+
+@end
+
+
+@implementation CPAttachmentCache
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+- (id)init
+{
+    return [self initWithMemoryLimit:64 * 1024 * 1024];
+}
+
+- (id)initWithMemoryLimit:(unsigned)bytes
+{
+    if (self = [super init])
+    {
+        lock = [[NSLock alloc] init];
+        limit = bytes;
+    }
+    
+    return self;
+}
+
+/***************************/
+/* Taking over attachments */
+/***************************/
+
+/***** Take over the pictures in some text *****/
+
+/*
+ * This goes through the attachment runs once, and gives every
+ * picture a lazy cell.  Attachments that aren't pictures (or
+ * don't have a file to decode from) keep the cell they have.
+ * It doesn't change the text, so it can be done before the text
+ * goes into the text storage.
+ */
+
+- (unsigned)adoptAttachmentsInText:(NSAttributedString *)text
+{
+    NSArray *imageTypes = [NSImage imageUnfilteredFileTypes];
+    unsigned location = 0;
+    unsigned end = [text length];
+    unsigned count = 0;
+    
+    while (location < end)
+    {
+        NSRange runRange;
+        NSTextAttachment *attachment = [text attribute:NSAttachmentAttributeName atIndex:location effectiveRange:&runRange];
+        NSFileWrapper *wrapper = [attachment fileWrapper];
+        NSString *name = ([wrapper preferredFilename] != nil) ? [wrapper preferredFilename] : [wrapper filename];
+        id oldCell = [attachment attachmentCell];
+        
+        if (attachment != nil && [wrapper isRegularFile] && ![oldCell isKindOfClass:[CPLazyAttachmentCell class]] &&
+            [imageTypes containsObject:[[name pathExtension] lowercaseString]])
+        {
+            // The old cell only had to read the picture's header to
+            // get its size, so it goes away without decoding anything
+            
+            CPLazyAttachmentCell *cell = [[CPLazyAttachmentCell alloc] initWithCache:self size:[oldCell cellSize]];
+            
+            cell->fileLength = [[wrapper regularFileContents] length];  // This doesn't read the file
+            
+            [lock lock];
+            attachmentCount++;
+            fileBytes += cell->fileLength;
+            [lock unlock];
+            
+            [attachment setAttachmentCell:cell];
+            [cell release];
+            
+            count++;
+        }
+        
+        location = NSMaxRange(runRange);
+    }
+    
+    return count;
+}
+
+/************************/
+/* The decoded pictures */
+/************************/
+
+// These are only called with the lock held
+
+/***** Put a cell at the front of the list *****/
+
+- (void)linkCell:(CPLazyAttachmentCell *)cell
+{
+    cell->newer = nil;
+    cell->older = newest;
+    
+    if (newest != nil)
+        newest->newer = cell;
+    
+    newest = cell;
+    
+    if (oldest == nil)
+        oldest = cell;
+}
+
+/***** Take a cell out of the list *****/
+
+- (void)unlinkCell:(CPLazyAttachmentCell *)cell
+{
+    if (cell->newer != nil)
+        cell->newer->older = cell->older;
+    else
+        newest = cell->older;
+    
+    if (cell->older != nil)
+        cell->older->newer = cell->newer;
+    else
+        oldest = cell->newer;
+    
+    cell->newer = nil;
+    cell->older = nil;
+}
+
+/***** Throw out a cell's picture *****/
+
+- (void)unloadCell:(CPLazyAttachmentCell *)cell
+{
+    [self unlinkCell:cell];
+    
+    usedBytes -= cell->cost;
+    loadedCount--;
+    
+    [cell->decodedImage release];
+    cell->decodedImage = nil;
+    cell->cost = 0;
+}
+
+/***** Get a cell's picture, decoding it if we have to *****/
+
+- (NSImage *)imageForCell:(CPLazyAttachmentCell *)cell
+{
+    NSData *data;
+    NSBitmapImageRep *rep;
+    NSImage *image;
+    unsigned imageCost;
+    
+    // Already decoded?  Then it's the most recently drawn now.
+    
+    [lock lock];
+    
+    if (cell->decodedImage != nil)
+    {
+        image = [[cell->decodedImage retain] autorelease];
+        
+        [self unlinkCell:cell];
+        [self linkCell:cell];
+        [lock unlock];
+        
+        return image;
+    }
+    
+    [lock unlock];
+    
+    // Decode it out of the file (without holding the lock)
+    
+    data = [[[cell attachment] fileWrapper] regularFileContents];
+    rep = (data != nil) ? [NSBitmapImageRep imageRepWithData:data] : nil;
+    
+    if (rep != nil)
+    {
+        image = [[NSImage alloc] initWithSize:[rep size]];
+        [image addRepresentation:rep];
+        imageCost = [rep bytesPerRow] * [rep pixelsHigh];
+    }
+    
+    else
+    {
+        // PDF and the like -- we don't know how big it is decoded,
+        // so count the file
+        
+        image = (data != nil) ? [[NSImage alloc] initWithData:data] : nil;
+        imageCost = [data length];
+    }
+    
+    if (image == nil)
+        return nil;  // Not a picture after all
+    
+    [lock lock];
+    
+    if (cell->decodedImage == nil)
+    {
+        cell->decodedImage = image;
+        cell->cost = imageCost;
+        
+        [self linkCell:cell];
+        usedBytes += imageCost;
+        loadedCount++;
+        
+        // Make room, but always keep the one we're drawing
+        
+        while (usedBytes > limit && oldest != cell)
+        {
+            [self unloadCell:oldest];
+        }
+    }
+    
+    else
+    {
+        [image release];  // Someone else beat us to it
+    }
+    
+    image = [[cell->decodedImage retain] autorelease];
+    
+    [lock unlock];
+    
+    return image;
+}
+
+/***** A cell is going away *****/
+
+- (void)forgetCell:(CPLazyAttachmentCell *)cell
+{
+    [lock lock];
+    
+    if (cell->decodedImage != nil)
+        [self unloadCell:cell];
+    
+    attachmentCount--;
+    fileBytes -= cell->fileLength;
+    
+    [lock unlock];
+}
+
+/*********************/
+/* The memory report */
+/*********************/
+
+- (unsigned)memoryLimit
+{
+    return limit;
+}
+
+- (unsigned long)usedBytes
+{
+    unsigned long value;
+    
+    [lock lock];
+    value = usedBytes;
+    [lock unlock];
+    
+    return value;
+}
+
+- (unsigned)loadedCount
+{
+    unsigned value;
+    
+    [lock lock];
+    value = loadedCount;
+    [lock unlock];
+    
+    return value;
+}
+
+- (unsigned)attachmentCount
+{
+    unsigned value;
+    
+    [lock lock];
+    value = attachmentCount;
+    [lock unlock];
+    
+    return value;
+}
+
+- (unsigned long)fileBytes
+{
+    unsigned long value;
+    
+    [lock lock];
+    value = fileBytes;
+    [lock unlock];
+    
+    return value;
+}
+
+/***** Clean up *****/
+
+// Every cell keeps us around, so by now they're all gone
+
+- (void)dealloc
+{
+    [lock release];
+    
+    [super dealloc];
+}
+
+@end
@@ -0,0 +1,47 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPBackupController.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPBackupController class.  See "CPBackupController.m" for info
+ on the CPBackupController class.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+@interface CPBackupController : NSObject
+{
+    NSString *backupPath;  // Where the backups go (Contents/Resources/Backups)
+    NSConditionLock *lock;  // Protects everything below, which the writer thread touches (the condition is whether it's writing)
+    BOOL writing;  // Is the writer thread still busy with the last tick?
+    
+    // Counters, so we can see what each tick actually costs
+    
+    unsigned lastDocumentCount;  // Documents written during the last tick
+    unsigned lastBytesWritten;  // Bytes written during the last tick
+    NSTimeInterval lastSnapshotTime;  // Time spent on the main thread during the last tick
+    NSTimeInterval lastWriteTime;  // Time spent on the writer thread during the last tick
+    unsigned long long totalBytesWritten;  // Bytes written since launch
+}
+
+- (id)initWithBackupPath:(NSString *)path;
+
+- (void)backupDocuments;  // Snapshot the edited documents and write them in the background
+- (void)waitUntilIdle;  // Block until the writer thread is done
+- (BOOL)isWriting;
+
+// Counters
+
+- (unsigned)lastDocumentCount;
+- (unsigned)lastBytesWritten;
+- (NSTimeInterval)lastSnapshotTime;
+- (NSTimeInterval)lastWriteTime;
+- (unsigned long long)totalBytesWritten;
+
+@end
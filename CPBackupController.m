@@ -0,0 +1,370 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPBackupController.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Does the actual work for Automatic Backup.  InterfaceController owns the
+ timer and calls backupDocuments every interval.
+ 
+ We used to throw away the whole Backups folder every tick and then save
+ every open document again, right on the main thread.  Now every document
+ remembers whether it changed since its last backup (see needsBackup in
+ MyDocument), and we only take a snapshot of those.  The snapshots are
+ encoded and written by a separate writer thread, so typing isn't held up
+ while the files are written.  Each backup file is written next to the old
+ one first and then renamed over it, so there is always a good backup on
+ disk, even if we crash halfway through.
+ 
+ Major events:
+ 
+ - 10/17/26: Split Automatic Backup out of InterfaceController, and made it
+             only write the documents that changed.
+ - 10/17/26: Documents whose backup couldn't be written are marked again, so
+             the next tick tries them again.  waitUntilIdle waits on the
+             lock's condition instead of polling.
+ - 10/17/26: Uses CPDocumentCodec's sizeOfFileWrapper: instead of its own
+             copy.
+ 
+ */
+
+#import "CPBackupController.h"
+#import "InterfaceController.h"
+#import "MyDocument.h"
+#import "CPDocumentCodec.h"
+
+// For rename()
+#import <stdio.h>
+
+/*************/
+/* Constants */
+/*************/
+
+// Keys used in the jobs we hand to the writer thread
+
+static NSString *CP_BackupTextKey = @"Text";
+static NSString *CP_BackupFormatKey = @"Format";
+static NSString *CP_BackupNameKey = @"Name";
+static NSString *CP_BackupJobsKey = @"Jobs";
+static NSString *CP_BackupKeepKey = @"Keep";
+
+// Conditions for the lock
+
+enum
+{
+    CPBackupIdle = 0,
+    CPBackupWriting
+};
+
+
+@implementation CPBackupController
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+- (id)initWithBackupPath:(NSString *)path
+{
+    if (self = [super init])
+    {
+        backupPath = [path copy];
+        lock = [[NSConditionLock alloc] initWithCondition:CPBackupIdle];
+        writing = NO;
+    }
+    
+    return self;
+}
+
+/******************/
+/* Backup methods */
+/******************/
+
+/***** Figure out what a document's backup file is called *****/
+
+- (NSString *)backupNameForDocument:(MyDocument *)document
+{
+    NSString *extension = [CPDocumentCodec pathExtensionForFormat:[document format]];
+    
+    if (extension == nil || ([document doc] && ![document supportsWordFormat]))
+        return nil;  // We can't back this one up
+    
+    return [[[document currentWindow] title] stringByAppendingPathExtension:extension];
+}
+
+/***** Take snapshots of the changed documents and hand them to the writer thread *****/
+
+/*
+ * This is the only part that runs on the main thread.  Copying the text
+ * storage is just a copy -- the expensive part (encoding RTF, RTFD, etc.)
+ * is done by CPDocumentCodec on the writer thread.
+ */
+
+- (void)backupDocuments
+{
+    NSDate *start = [NSDate date];
+    NSEnumerator *documentList;
+    NSMutableArray *jobs;
+    NSMutableSet *keep;
+    NSDictionary *batch;
+    MyDocument *document;
+    
+    // If the writer is still busy with the last tick, skip this one.  The
+    // documents stay marked, so they'll get picked up next time.
+    
+    if ([self isWriting])
+    {
+        return;
+    }
+    
+    documentList = [[[NSDocumentController sharedDocumentController] documents] objectEnumerator];
+    jobs = [NSMutableArray array];
+    keep = [NSMutableSet set];
+    
+    while (document = [documentList nextObject])
+    {
+        NSString *name;
+        
+        // Saved documents don't need a backup (and we'll delete the old one)
+        
+        if (![document isDocumentEdited])
+            continue;
+        
+        name = [self backupNameForDocument:document];
+        
+        if (name == nil)
+            continue;
+        
+        [keep addObject:name];
+        
+        // Only snapshot documents that changed since their last backup
+        
+        if ([document needsBackup])
+        {
+            [jobs addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                [document textSnapshot], CP_BackupTextKey,
+                [NSNumber numberWithInt:[document format]], CP_BackupFormatKey,
+                name, CP_BackupNameKey,
+                nil]];
+            
+            [document setNeedsBackup:NO];
+        }
+    }
+    
+    batch = [NSDictionary dictionaryWithObjectsAndKeys:jobs, CP_BackupJobsKey, keep, CP_BackupKeepKey, nil];
+    
+    [lock lock];
+    writing = YES;
+    lastSnapshotTime = -[start timeIntervalSinceNow];
+    [lock unlockWithCondition:CPBackupWriting];
+    
+    [NSThread detachNewThreadSelector:@selector(writeBackups:) toTarget:self withObject:batch];
+}
+
+/***** The writer thread *****/
+
+- (void)writeBackups:(NSDictionary *)batch
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSDate *start = [NSDate date];
+    NSEnumerator *jobList = [[batch objectForKey:CP_BackupJobsKey] objectEnumerator];
+    NSSet *keep = [batch objectForKey:CP_BackupKeepKey];
+    NSMutableSet *failed = [NSMutableSet set];
+    NSEnumerator *fileList;
+    NSDictionary *job;
+    NSString *file;
+    unsigned bytes = 0;
+    unsigned count = 0;
+    
+    while (job = [jobList nextObject])
+    {
+        NSAutoreleasePool *jobPool = [[NSAutoreleasePool alloc] init];  // Snapshots can be big
+        NSString *name = [job objectForKey:CP_BackupNameKey];
+        NSString *path = [backupPath stringByAppendingPathComponent:name];
+        NSString *tempPath = [backupPath stringByAppendingPathComponent:[@"." stringByAppendingString:name]];
+        NSFileWrapper *wrapper = [CPDocumentCodec fileWrapperFromText:[job objectForKey:CP_BackupTextKey] format:[[job objectForKey:CP_BackupFormatKey] intValue]];
+        
+        // Write next to the old backup, then swap it in.  rename() replaces
+        // regular files atomically; RTFD folders have to be moved out of the
+        // way first.
+        
+        [fileManager removeFileAtPath:tempPath handler:nil];
+        
+        if (wrapper != nil && [wrapper writeToFile:tempPath atomically:NO updateFilenames:NO])
+        {
+            if ([wrapper isDirectory])
+                [fileManager removeFileAtPath:path handler:nil];
+            
+            if (rename([tempPath fileSystemRepresentation], [path fileSystemRepresentation]) == 0)
+            {
+                bytes += [CPDocumentCodec sizeOfFileWrapper:wrapper];
+                count++;
+            }
+            
+            else
+            {
+                NSLog(@"Something fishy happened when trying to replace the backup file %@...", name);
+                [failed addObject:name];
+            }
+        }
+        
+        else
+        {
+            NSLog(@"Something fishy happened when trying to write the backup file %@...", name);
+            [failed addObject:name];
+        }
+        
+        [jobPool release];
+    }
+    
+    // Get rid of backups for documents that were closed or saved (and
+    // anything left over from a write that didn't finish)
+    
+    fileList = [[fileManager directoryContentsAtPath:backupPath] objectEnumerator];
+    
+    while (file = [fileList nextObject])
+    {
+        if (![keep containsObject:file])
+        {
+            [fileManager removeFileAtPath:[backupPath stringByAppendingPathComponent:file] handler:nil];
+        }
+    }
+    
+    // Update the counters
+    
+    [lock lock];
+    
+    lastDocumentCount = count;
+    lastBytesWritten = bytes;
+    lastWriteTime = -[start timeIntervalSinceNow];
+    totalBytesWritten += bytes;
+    writing = NO;
+    
+    [lock unlockWithCondition:CPBackupIdle];
+    
+    // The documents we couldn't back up have to be tried again next time
+    
+    if ([failed count] > 0)
+    {
+        [self performSelectorOnMainThread:@selector(backupsFailed:) withObject:failed waitUntilDone:NO];
+    }
+    
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+    {
+        NSLog(@"Automatic Backup: wrote %u document(s), %u bytes (%qu total); %.3f sec on the main thread, %.3f sec writing", count, bytes, totalBytesWritten, lastSnapshotTime, lastWriteTime);
+    }
+    
+    [pool release];
+}
+
+/***** Mark the documents that didn't get backed up (on the main thread) *****/
+
+/*
+ * We only get their backup names back, so a document that was
+ * closed in the meantime is never touched from the writer thread.
+ */
+
+- (void)backupsFailed:(NSSet *)names
+{
+    NSEnumerator *documentList = [[[NSDocumentController sharedDocumentController] documents] objectEnumerator];
+    MyDocument *document;
+    
+    while (document = [documentList nextObject])
+    {
+        NSString *name = [self backupNameForDocument:document];
+        
+        if (name != nil && [names containsObject:name])
+            [document setNeedsBackup:YES];
+    }
+}
+
+/***** Wait for the writer thread (used when quitting) *****/
+
+- (void)waitUntilIdle
+{
+    // The writer sets the condition back to idle when it's done
+    
+    [lock lockWhenCondition:CPBackupIdle];
+    [lock unlock];
+}
+
+/********************/
+/* Accessor methods */
+/********************/
+
+- (BOOL)isWriting
+{
+    BOOL result;
+    
+    [lock lock];
+    result = writing;
+    [lock unlock];
+    
+    return result;
+}
+
+- (unsigned)lastDocumentCount
+{
+    unsigned result;
+    
+    [lock lock];
+    result = lastDocumentCount;
+    [lock unlock];
+    
+    return result;
+}
+
+- (unsigned)lastBytesWritten
+{
+    unsigned result;
+    
+    [lock lock];
+    result = lastBytesWritten;
+    [lock unlock];
+    
+    return result;
+}
+
+- (NSTimeInterval)lastSnapshotTime
+{
+    NSTimeInterval result;
+    
+    [lock lock];
+    result = lastSnapshotTime;
+    [lock unlock];
+    
+    return result;
+}
+
+- (NSTimeInterval)lastWriteTime
+{
+    NSTimeInterval result;
+    
+    [lock lock];
+    result = lastWriteTime;
+    [lock unlock];
+    
+    return result;
+}
+
+- (unsigned long long)totalBytesWritten
+{
+    unsigned long long result;
+    
+    [lock lock];
+    result = totalBytesWritten;
+    [lock unlock];
+    
+    return result;
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [backupPath release];
+    [lock release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
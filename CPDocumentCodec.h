@@ -0,0 +1,66 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPDocumentCodec.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPDocumentCodec class.  See "CPDocumentCodec.m" for info on
+ the CPDocumentCodec class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/*************/
+/* Constants */
+/*************/
+
+// The formats CocoaPad can read and write
+
+typedef enum
+{
+    CPFormatUnknown = -1,
+    CPFormatCPD = 0,
+    CPFormatRTF,
+    CPFormatRTFD,
+    CPFormatWord,
+    CPFormatText
+} CPDocumentFormat;
+
+/***********/
+/* Methods */
+/***********/
+
+@interface CPDocumentCodec : NSObject
+{
+}
+
+// Formats and file extensions
+
++ (CPDocumentFormat)formatForPathExtension:(NSString *)extension;
++ (NSString *)pathExtensionForFormat:(CPDocumentFormat)format;
++ (BOOL)supportsWordFormat;  // Mac OS X 10.3 Panther and up
+
+// Encoding (these never touch a document, so they're safe to call from any thread)
+
++ (NSData *)dataFromText:(NSAttributedString *)text format:(CPDocumentFormat)format;
++ (NSFileWrapper *)fileWrapperFromText:(NSAttributedString *)text format:(CPDocumentFormat)format;
+
+// Decoding
+
++ (NSAttributedString *)textFromData:(NSData *)data format:(CPDocumentFormat)format;
++ (NSAttributedString *)textFromFileWrapper:(NSFileWrapper *)wrapper format:(CPDocumentFormat)format;
++ (NSFileWrapper *)fileWrapperWithContentsOfPath:(NSString *)path;  // Every file in it is memory mapped
+
+// Decoding plain text a piece at a time (for big files)
+
++ (NSStringEncoding)encodingOfTextData:(NSData *)data headerLength:(unsigned *)length;
++ (NSString *)stringFromTextData:(NSData *)data encoding:(NSStringEncoding)encoding location:(unsigned *)location maxLength:(unsigned)maxLength;
+
+// Utilities
+
++ (NSAttributedString *)textWithoutAttachments:(NSAttributedString *)text count:(unsigned *)count bytes:(unsigned *)bytes;
++ (unsigned)removeAttachmentsFromText:(NSMutableAttributedString *)text bytes:(unsigned *)bytes;  // Returns how many were removed
++ (unsigned)sizeOfFileWrapper:(NSFileWrapper *)wrapper;  // In bytes, counting every file in it
+
+@end
@@ -0,0 +1,717 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPDocumentCodec.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Turns text into CPD, RTF, RTFD, Word, and plain text files.
+ 
+ This used to be done by MyDocument's fileWrapperRepresentationOfType:,
+ which also reset the format flags, stripped the attachments out of the
+ document, cleared the undo history, and updated the text view every time
+ it was called -- even for automatic backups.  CPDocumentCodec only ever
+ works on the attributed string it's given (usually a snapshot of the text
+ storage), and never changes it, so saving doesn't touch the document and
+ backups can be encoded on another thread.
+ 
+ Major events:
+ 
+ - 10/17/26: Moved the document encoding code out of MyDocument.
+ - 10/17/26: Added chunked plain text decoding, for opening huge files.
+ - 10/17/26: Added decoding for the rest of the formats, so opening a file
+             only parses it once.
+ - 10/17/26: Removing attachments takes one pass through the text now,
+             instead of deleting them one at a time.
+ - 10/17/26: RTFD packages are read with every file memory mapped, so
+             pictures aren't read until they're drawn (or saved).
+ - 10/17/26: The encoding of a plain text file is worked out from the first
+             64K instead of the whole file.  A piece that turns out not to
+             be UTF-8 after all is decoded as Latin 1.
+ - 10/17/26: Added sizeOfFileWrapper:, which CPBackupController and cpconvert
+             both had their own copies of.
+ - 10/17/26: A piece of a UTF-8 file with a bad byte in it isn't decoded as
+             Latin 1 anymore -- just the bad bytes are, and the rest stays
+             UTF-8.  Saving it again used to garble every other accented
+             character in the piece.
+ 
+ */
+
+#import "CPDocumentCodec.h"
+
+// For AppKit's extension to NSAttributedString
+#import <AppKit/NSAttributedString.h>
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_EncodingSniffLength (64 * 1024)  // How much of a plain text file we look at to guess its encoding
+
+/*****************/
+/* Damaged UTF-8 */
+/*****************/
+
+/***** How long is the UTF-8 sequence at the start of the bytes? *****/
+
+// Returns 0 if it isn't a valid (complete, shortest-form) sequence
+
+static unsigned CPUTF8SequenceLength(const unsigned char *bytes, unsigned length)
+{
+    unsigned char lead = bytes[0];
+    unsigned char low = 0x80, high = 0xBF;  // What the second byte can be
+    unsigned trailing, i;
+    
+    if (lead < 0x80)
+        return 1;
+    
+    else if (lead >= 0xC2 && lead <= 0xDF)
+        trailing = 1;
+    
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        trailing = 2;
+        
+        if (lead == 0xE0)
+            low = 0xA0;  // Too long otherwise
+        
+        else if (lead == 0xED)
+            high = 0x9F;  // Surrogates
+    }
+    
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        trailing = 3;
+        
+        if (lead == 0xF0)
+            low = 0x90;  // Too long otherwise
+        
+        else if (lead == 0xF4)
+            high = 0x8F;  // Past U+10FFFF
+    }
+    
+    else
+        return 0;  // Not a valid lead byte
+    
+    if (trailing >= length || bytes[1] < low || bytes[1] > high)
+        return 0;
+    
+    for (i = 2; i <= trailing; i++)
+    {
+        if ((bytes[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    
+    return trailing + 1;
+}
+
+/***** Decode UTF-8 that has some bad bytes in it *****/
+
+/*
+ * Every valid sequence is decoded as UTF-8, and each byte that
+ * isn't part of one is taken as Latin 1 (it's probably a stray
+ * accented character from some other program).  That way, one
+ * bad byte doesn't turn the rest of the piece into garbage.
+ * Returns a retained string, like NSString's initializers.
+ */
+
+static NSString *CPStringFromDamagedUTF8(const unsigned char *bytes, unsigned length)
+{
+    unichar *characters = malloc(MAX(length, 1) * sizeof(unichar));  // Never more characters than bytes
+    unsigned i = 0, count = 0;
+    
+    while (i < length)
+    {
+        unsigned sequence = CPUTF8SequenceLength(bytes + i, length - i);
+        const unsigned char *b = bytes + i;
+        
+        if (sequence == 0)
+        {
+            characters[count++] = b[0];  // Latin 1 maps straight to Unicode
+            i++;
+            continue;
+        }
+        
+        if (sequence == 1)
+            characters[count++] = b[0];
+        
+        else if (sequence == 2)
+            characters[count++] = ((b[0] & 0x1F) << 6) | (b[1] & 0x3F);
+        
+        else if (sequence == 3)
+            characters[count++] = ((b[0] & 0x0F) << 12) | ((b[1] & 0x3F) << 6) | (b[2] & 0x3F);
+        
+        else
+        {
+            unsigned long character = (((b[0] & 0x07) << 18) | ((b[1] & 0x3F) << 12) | ((b[2] & 0x3F) << 6) | (b[3] & 0x3F)) - 0x10000;
+            
+            characters[count++] = 0xD800 + (character >> 10);  // A surrogate pair
+            characters[count++] = 0xDC00 + (character & 0x3FF);
+        }
+        
+        i += sequence;
+    }
+    
+    return [[NSString alloc] initWithCharactersNoCopy:characters length:count freeWhenDone:YES];
+}
+
+
+@implementation CPDocumentCodec
+
+/*******************************/
+/* Formats and file extensions */
+/*******************************/
+
+/***** Which format goes with a file extension? *****/
+
++ (CPDocumentFormat)formatForPathExtension:(NSString *)extension
+{
+    extension = [extension lowercaseString];
+    
+    if ([extension isEqualToString:@"cpd"])
+        return CPFormatCPD;
+    
+    else if ([extension isEqualToString:@"rtf"])
+        return CPFormatRTF;
+    
+    else if ([extension isEqualToString:@"rtfd"])
+        return CPFormatRTFD;
+    
+    else if ([extension isEqualToString:@"doc"])
+        return CPFormatWord;
+    
+    else if ([extension isEqualToString:@"txt"])
+        return CPFormatText;
+    
+    return CPFormatUnknown;
+}
+
+/***** Which file extension goes with a format? *****/
+
++ (NSString *)pathExtensionForFormat:(CPDocumentFormat)format
+{
+    switch (format)
+    {
+        case CPFormatCPD:
+            return @"cpd";
+        
+        case CPFormatRTF:
+            return @"rtf";
+        
+        case CPFormatRTFD:
+            return @"rtfd";
+        
+        case CPFormatWord:
+            return @"doc";
+        
+        case CPFormatText:
+            return @"txt";
+        
+        default:
+            return nil;
+    }
+}
+
+/***** Can we read and write Word files? *****/
+
++ (BOOL)supportsWordFormat
+{
+    // Word support was added in Panther
+    return [NSAttributedString instancesRespondToSelector:@selector(docFormatFromRange:documentAttributes:)];
+}
+
+/************/
+/* Encoding */
+/************/
+
+/***** Encode the text as one of the single-file formats *****/
+
+/*
+ * RTFD is a folder, so it doesn't come out of here (use
+ * fileWrapperFromText:format: instead).  Returns nil if the
+ * text can't be encoded in the given format.
+ */
+
++ (NSData *)dataFromText:(NSAttributedString *)text format:(CPDocumentFormat)format
+{
+    NSRange range = NSMakeRange(0, [text length]);
+    
+    // RTF, Word, and plain text can't hold graphics, so we strip them
+    // from a copy -- the text we were given stays the way it is
+    
+    if ((format == CPFormatRTF || format == CPFormatWord || format == CPFormatText) && [text containsAttachments])
+    {
+        text = [self textWithoutAttachments:text count:NULL bytes:NULL];
+        range = NSMakeRange(0, [text length]);
+    }
+    
+    switch (format)
+    {
+        case CPFormatCPD:
+            return [text RTFDFromRange:range documentAttributes:nil];
+        
+        case CPFormatRTF:
+            return [text RTFFromRange:range documentAttributes:nil];
+        
+        case CPFormatWord:
+            return ([self supportsWordFormat]) ? [text docFormatFromRange:range documentAttributes:nil] : nil;
+        
+        case CPFormatText:
+            return [[text string] dataUsingEncoding:NSUTF8StringEncoding];  // We use Unicode UTF-8
+        
+        default:
+            return nil;
+    }
+}
+
+/***** Encode the text as a file wrapper (this works for every format) *****/
+
++ (NSFileWrapper *)fileWrapperFromText:(NSAttributedString *)text format:(CPDocumentFormat)format
+{
+    NSData *data;
+    
+    if (format == CPFormatRTFD)
+    {
+        return [text RTFDFileWrapperFromRange:NSMakeRange(0, [text length]) documentAttributes:nil];
+    }
+    
+    data = [self dataFromText:text format:format];
+    
+    if (data == nil)
+        return nil;
+    
+    return [[[NSFileWrapper alloc] initRegularFileWithContents:data] autorelease];
+}
+
+/************/
+/* Decoding */
+/************/
+
+/***** Decode a single-file format *****/
+
+/*
+ * CPD files are really RTFD data, so they're decoded the same
+ * way.  Returns nil if the data can't be decoded.
+ */
+
++ (NSAttributedString *)textFromData:(NSData *)data format:(CPDocumentFormat)format
+{
+    NSAttributedString *text = nil;
+    
+    switch (format)
+    {
+        case CPFormatCPD:
+        case CPFormatRTFD:
+            text = [[NSAttributedString alloc] initWithRTFD:data documentAttributes:nil];
+            break;
+        
+        case CPFormatRTF:
+            text = [[NSAttributedString alloc] initWithRTF:data documentAttributes:nil];
+            break;
+        
+        case CPFormatWord:
+            if ([self supportsWordFormat])
+                text = [[NSAttributedString alloc] initWithDocFormat:data documentAttributes:nil];
+            break;
+        
+        case CPFormatText:
+        {
+            unsigned location;
+            NSStringEncoding encoding = [self encodingOfTextData:data headerLength:&location];
+            NSString *string = [self stringFromTextData:data encoding:encoding location:&location maxLength:[data length]];
+            
+            text = [[NSAttributedString alloc] initWithString:(string == nil) ? @"" : string];
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    return [text autorelease];
+}
+
+/***** Decode a file wrapper (this works for every format) *****/
+
++ (NSAttributedString *)textFromFileWrapper:(NSFileWrapper *)wrapper format:(CPDocumentFormat)format
+{
+    if ([wrapper isDirectory])
+    {
+        return [[[NSAttributedString alloc] initWithRTFDFileWrapper:wrapper documentAttributes:nil] autorelease];
+    }
+    
+    return [self textFromData:[wrapper regularFileContents] format:format];
+}
+
+/***** Read a file or package without reading what's in it *****/
+
+/*
+ * NSFileWrapper's initWithPath: reads every file in an RTFD package
+ * into memory, pictures and all.  This memory maps them instead, so
+ * a picture isn't read until it's decoded, and saving copies the
+ * file straight from the mapping.  Returns nil if the path doesn't
+ * exist.
+ */
+
++ (NSFileWrapper *)fileWrapperWithContentsOfPath:(NSString *)path
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSFileWrapper *wrapper = nil;
+    BOOL isDirectory;
+    
+    if (![fileManager fileExistsAtPath:path isDirectory:&isDirectory])
+        return nil;
+    
+    if (isDirectory)
+    {
+        NSArray *names = [fileManager directoryContentsAtPath:path];
+        NSMutableDictionary *wrappers = [NSMutableDictionary dictionaryWithCapacity:[names count]];
+        unsigned i;
+        
+        for (i = 0; i < [names count]; i++)
+        {
+            NSString *name = [names objectAtIndex:i];
+            NSFileWrapper *child = [self fileWrapperWithContentsOfPath:[path stringByAppendingPathComponent:name]];
+            
+            if (child != nil)
+            {
+                [child setPreferredFilename:name];
+                [wrappers setObject:child forKey:name];
+            }
+        }
+        
+        wrapper = [[NSFileWrapper alloc] initDirectoryWithFileWrappers:wrappers];
+    }
+    
+    else
+    {
+        NSData *data = [NSData dataWithContentsOfMappedFile:path];
+        
+        if (data == nil)
+            return nil;
+        
+        wrapper = [[NSFileWrapper alloc] initRegularFileWithContents:data];
+    }
+    
+    [wrapper setPreferredFilename:[path lastPathComponent]];
+    
+    return [wrapper autorelease];
+}
+
+/***** Figure out how a plain text file is encoded *****/
+
+/*
+ * We look for a byte order mark first (UTF-8, or UTF-16 in
+ * either byte order).  Without one, the file is UTF-8 if every
+ * byte sequence in the first 64K is valid UTF-8 (plain ASCII is
+ * too), and ISO Latin 1 otherwise -- every byte is valid Latin 1,
+ * so we can always open the file.  We used to check the whole
+ * file, which meant reading all of it before the first screen
+ * could show up.  If there's a bad sequence further in, just its
+ * bytes get decoded as Latin 1 (see stringFromTextData:...).
+ * length is set to the size of the byte order mark, which the
+ * decoder skips.
+ */
+
++ (NSStringEncoding)encodingOfTextData:(NSData *)data headerLength:(unsigned *)length
+{
+    const unsigned char *bytes = [data bytes];
+    unsigned fileLength = [data length];
+    unsigned dataLength = MIN(fileLength, CP_EncodingSniffLength);
+    unsigned i = 0;
+    
+    // Byte order marks
+    
+    if (dataLength >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+    {
+        *length = 3;
+        return NSUTF8StringEncoding;
+    }
+    
+    if (dataLength >= 2 && ((bytes[0] == 0xFE && bytes[1] == 0xFF) || (bytes[0] == 0xFF && bytes[1] == 0xFE)))
+    {
+        *length = 2;
+        return NSUnicodeStringEncoding;
+    }
+    
+    *length = 0;
+    
+    // No byte order mark, so check if it's valid UTF-8.  This reads
+    // straight out of the (memory mapped) data, without copying it.
+    
+    while (i < dataLength)
+    {
+        unsigned char byte = bytes[i];
+        unsigned trailing;
+        
+        if (byte < 0x80)
+        {
+            i++;
+            continue;
+        }
+        
+        else if (byte >= 0xC2 && byte <= 0xDF)
+            trailing = 1;
+        
+        else if (byte >= 0xE0 && byte <= 0xEF)
+            trailing = 2;
+        
+        else if (byte >= 0xF0 && byte <= 0xF4)
+            trailing = 3;
+        
+        else
+            break;  // Not a valid lead byte
+        
+        if (i + trailing >= dataLength)
+        {
+            if (dataLength < fileLength)
+                i = dataLength;  // It goes on past what we looked at, so it's fine
+            
+            break;  // Otherwise, it's cut off at the end
+        }
+        
+        for (i++; trailing > 0; trailing--, i++)
+        {
+            if ((bytes[i] & 0xC0) != 0x80)
+                break;
+        }
+        
+        if (trailing > 0)
+            break;  // Not enough continuation bytes
+    }
+    
+    return (i >= dataLength) ? NSUTF8StringEncoding : NSISOLatin1StringEncoding;
+}
+
+/***** Decode the next piece of a plain text file *****/
+
+/*
+ * Decodes up to maxLength bytes starting at location, and moves
+ * location past them.  The piece always ends on a character
+ * boundary, so a multi-byte UTF-8 sequence or a UTF-16 surrogate
+ * pair is never split between two pieces.  Returns nil when
+ * there's nothing left.
+ */
+
++ (NSString *)stringFromTextData:(NSData *)data encoding:(NSStringEncoding)encoding location:(unsigned *)location maxLength:(unsigned)maxLength
+{
+    const unsigned char *bytes = [data bytes];
+    unsigned dataLength = [data length];
+    unsigned start = *location;
+    unsigned end;
+    NSString *string;
+    
+    if (start >= dataLength)
+        return nil;
+    
+    end = (maxLength < dataLength - start) ? start + maxLength : dataLength;
+    
+    if (encoding == NSUnicodeStringEncoding)
+    {
+        BOOL bigEndian = (bytes[0] == 0xFE);  // We only get here if there was a byte order mark
+        unsigned count, i;
+        unichar *characters;
+        
+        // Stop on an even byte, and don't split a surrogate pair
+        
+        end = start + ((end - start) & ~1U);
+        
+        if (end < dataLength - 1)
+        {
+            unichar last = (bigEndian) ? (bytes[end - 2] << 8) | bytes[end - 1] : (bytes[end - 1] << 8) | bytes[end - 2];
+            
+            if (last >= 0xD800 && last <= 0xDBFF && end - start > 2)
+                end -= 2;
+        }
+        
+        if (end <= start)
+        {
+            *location = dataLength;  // A stray byte at the end
+            return nil;
+        }
+        
+        count = (end - start) / 2;
+        characters = malloc(count * sizeof(unichar));
+        
+        for (i = 0; i < count; i++)
+        {
+            const unsigned char *pair = bytes + start + (i * 2);
+            characters[i] = (bigEndian) ? (pair[0] << 8) | pair[1] : (pair[1] << 8) | pair[0];
+        }
+        
+        string = [[NSString alloc] initWithCharactersNoCopy:characters length:count freeWhenDone:YES];
+    }
+    
+    else
+    {
+        // Back up to the start of a UTF-8 sequence (Latin 1 doesn't care)
+        
+        if (encoding == NSUTF8StringEncoding && end < dataLength)
+        {
+            unsigned limit = end;
+            
+            while (end > start && (bytes[end] & 0xC0) == 0x80)
+                end--;
+            
+            if (end == start)
+                end = limit;  // Garbage -- just let NSString deal with it
+        }
+        
+        string = [[NSString alloc] initWithBytes:bytes + start length:end - start encoding:encoding];
+        
+        // We only checked the start of the file, so this piece might have
+        // some bad bytes in it.  Only those get decoded as Latin 1 -- the
+        // rest of the piece is still UTF-8, and it has to stay that way
+        // when it's saved.
+        
+        if (string == nil && encoding == NSUTF8StringEncoding)
+        {
+            string = CPStringFromDamagedUTF8(bytes + start, end - start);
+        }
+    }
+    
+    *location = end;
+    
+    return [string autorelease];
+}
+
+/*************/
+/* Utilities */
+/*************/
+
+/***** Make a copy of the text without any attachments, graphics, etc. *****/
+
+/*
+ * This used to be Ali Ozer's loop from TextEdit, which deleted the
+ * attachments one character at a time.  Every deletion moved the
+ * rest of the text (and its attributes) down, so a document with
+ * hundreds of pictures took forever.  Now we find all of them in
+ * one pass over the attribute runs, and copy the pieces in between
+ * into a new string.  If there's nothing to remove, we just hand
+ * back the text we were given.
+ *
+ * count and bytes (either can be NULL) are set to how many
+ * attachments were dropped, and how much file data went with them.
+ */
+
++ (NSAttributedString *)textWithoutAttachments:(NSAttributedString *)text count:(unsigned *)count bytes:(unsigned *)bytes
+{
+    NSString *string = [text string];
+    NSMutableAttributedString *strippedText = nil;
+    unsigned location = 0;
+    unsigned end = [text length];
+    unsigned segmentStart = 0;  // Where the text we're keeping starts
+    unsigned removed = 0;
+    unsigned removedBytes = 0;
+    
+    // Go through the document, looking for attachments
+    
+    while (location < end)
+    {
+        NSRange runRange;
+        NSTextAttachment *attachment = [text attribute:NSAttachmentAttributeName atIndex:location longestEffectiveRange:&runRange inRange:NSMakeRange(location, end - location)];
+        
+        if (attachment != nil)
+        {
+            // Okay...I think we found something.  Each attachment usually
+            // gets its own run, but check every character just in case.
+            
+            for (; location < NSMaxRange(runRange); location++)
+            {
+                if ([string characterAtIndex:location] == NSAttachmentCharacter)
+                {
+                    NSFileWrapper *wrapper = [[text attribute:NSAttachmentAttributeName atIndex:location effectiveRange:NULL] fileWrapper];
+                    
+                    // Yes, it's an attachment -- keep everything before it
+                    
+                    if (strippedText == nil)
+                    {
+                        strippedText = [[[NSMutableAttributedString alloc] init] autorelease];
+                        [strippedText beginEditing];
+                    }
+                    
+                    if (location > segmentStart)
+                    {
+                        [strippedText appendAttributedString:[text attributedSubstringFromRange:NSMakeRange(segmentStart, location - segmentStart)]];
+                    }
+                    
+                    segmentStart = location + 1;
+                    removed++;
+                    
+                    if ([wrapper isRegularFile])
+                    {
+                        removedBytes += [[wrapper regularFileContents] length];
+                    }
+                }
+            }
+        }
+        
+        else
+        {
+            location = NSMaxRange(runRange);
+        }
+    }
+    
+    if (count != NULL)
+        *count = removed;
+    
+    if (bytes != NULL)
+        *bytes = removedBytes;
+    
+    if (strippedText == nil)
+        return text;  // Nothing to remove
+    
+    // Keep whatever's after the last one
+    
+    if (end > segmentStart)
+    {
+        [strippedText appendAttributedString:[text attributedSubstringFromRange:NSMakeRange(segmentStart, end - segmentStart)]];
+    }
+    
+    [strippedText endEditing];  // Okay, we're done
+    
+    return strippedText;
+}
+
+/***** Remove all attachments, graphics, etc. *****/
+
+/*
+ * The text only gets changed once, no matter how many
+ * attachments there are.
+ */
+
++ (unsigned)removeAttachmentsFromText:(NSMutableAttributedString *)text bytes:(unsigned *)bytes
+{
+    unsigned count;
+    NSAttributedString *strippedText = [self textWithoutAttachments:text count:&count bytes:bytes];
+    
+    if (count > 0)
+    {
+        [text setAttributedString:strippedText];
+    }
+    
+    return count;
+}
+
+/***** Add up the size of a file wrapper (RTFD wrappers are folders) *****/
+
++ (unsigned)sizeOfFileWrapper:(NSFileWrapper *)wrapper
+{
+    NSEnumerator *children;
+    NSFileWrapper *child;
+    unsigned size = 0;
+    
+    if ([wrapper isRegularFile])
+    {
+        return [[wrapper regularFileContents] length];
+    }
+    
+    children = [[wrapper fileWrappers] objectEnumerator];
+    
+    while (child = [children nextObject])
+    {
+        size += [self sizeOfFileWrapper:child];
+    }
+    
+    return size;
+}
+
+@end
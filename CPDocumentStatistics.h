@@ -0,0 +1,60 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPDocumentStatistics.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPDocumentStatistics class.  See "CPDocumentStatistics.m" for
+ info on the CPDocumentStatistics class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/*************/
+/* Constants */
+/*************/
+
+// What we remember about each paragraph
+
+typedef struct
+{
+    unsigned length;  // Including the paragraph break
+    unsigned words;
+    unsigned lineBreaks;  // Line separators inside the paragraph
+} CPParagraphStatistics;
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+@interface CPDocumentStatistics : NSObject
+{
+    NSTextStorage *textStorage;  // The text we're counting (not retained -- the document owns it)
+    
+    struct CPParagraphNode *paragraphs;  // A tree with one for each paragraph, in order (the last one never has a paragraph break)
+    unsigned long seed;  // For the tree's random priorities
+    
+    // Totals
+    
+    unsigned characters;
+    unsigned words;
+    unsigned nonEmptyParagraphs;
+    unsigned lines;
+}
+
+- (id)initWithTextStorage:(NSTextStorage *)storage;
+
+// The counts (always up to date)
+
+- (unsigned)characterCount;
+- (unsigned)wordCount;
+- (unsigned)paragraphCount;
+- (unsigned)lineCount;
+
+// Counting
+
+- (void)recount;  // Start over from scratch
+- (void)textStorageDidProcessEditing:(NSNotification *)notification;
+
+@end
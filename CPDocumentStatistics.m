@@ -0,0 +1,608 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPDocumentStatistics.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Keeps track of how many characters, words, paragraphs, and lines are in a
+ document.
+ 
+ Word Count used to ask the text storage for its words, paragraphs, and
+ characters arrays every time, which makes an object for every single
+ character just to get three numbers.  Now each document has one of these
+ (see statistics in MyDocument).  It counts the text once, straight out of
+ the text storage's characters, and remembers the counts for every
+ paragraph.  After that, it watches the text storage, and whenever the text
+ changes, only the paragraphs that were edited (plus the ones on either
+ side, in case a paragraph break was added or removed) are counted again.
+ 
+ The paragraphs are kept in a treap (like the pieces in CPPieceTableStorage),
+ where each node knows how many characters and paragraphs are under it.
+ Finding the paragraph an edit starts in, and swapping the recounted ones
+ in, only takes about log(n) steps, so typing at the end of a document with
+ a hundred thousand paragraphs isn't any slower than in a short one.
+ 
+ Words are counted the same way everywhere: a word is a run of letters and
+ numbers (apostrophes don't break a word, so "don't" is one word).  Lines
+ are paragraphs plus line separators (Shift-Return), since the lines on
+ screen depend on the window size.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: The paragraphs are in a tree instead of an array.  Every
+             keystroke used to walk the array from the top to find where it
+             was, then slide everything after it over.
+ 
+ */
+
+#import "CPDocumentStatistics.h"
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_ScanBufferLength 4096  // How many characters we read at a time
+
+// What kind of character is it?
+
+enum
+{
+    CPSpaceCharacter = 0,  // Anything that separates words
+    CPWordCharacter,
+    CPJoinerCharacter,  // Apostrophes
+    CPParagraphBreakCharacter,
+    CPLineBreakCharacter
+};
+
+// One paragraph in the tree
+
+typedef struct CPParagraphNode
+{
+    struct CPParagraphNode *left;  // The paragraphs before this one...
+    struct CPParagraphNode *right;  // ...and after it
+    unsigned priority;  // Keeps the tree balanced
+    CPParagraphStatistics statistics;
+    unsigned total;  // How many characters are in this paragraph and everything under it
+    unsigned count;  // ...and how many paragraphs
+} CPParagraphNode;
+
+static unsigned char CPCharacterClasses[128];  // ASCII is looked up in here
+static NSCharacterSet *CPWordCharacters = nil;  // Everything else is checked against this
+
+/***** What kind of character is this? *****/
+
+static int CPClassOfCharacter(unichar character)
+{
+    if (character < 128)
+        return CPCharacterClasses[character];
+    
+    switch (character)
+    {
+        case 0x0085:  // Next line
+        case 0x2029:  // Paragraph separator
+            return CPParagraphBreakCharacter;
+        
+        case 0x2028:  // Line separator
+            return CPLineBreakCharacter;
+        
+        case 0x2019:  // Right single quote (a curly apostrophe)
+            return CPJoinerCharacter;
+        
+        default:
+            return ([CPWordCharacters characterIsMember:character]) ? CPWordCharacter : CPSpaceCharacter;
+    }
+}
+
+/***** Add a paragraph to (or take it out of) the totals *****/
+
+static void CPAddParagraph(CPParagraphStatistics *paragraph, unsigned *characters, unsigned *words, unsigned *paragraphs, unsigned *lines, int sign)
+{
+    *characters += sign * (int)paragraph->length;
+    *words += sign * (int)paragraph->words;
+    
+    if (paragraph->length > 0)
+    {
+        *paragraphs += sign;
+        *lines += sign * (int)(paragraph->lineBreaks + 1);
+    }
+}
+
+/**********************/
+/* The paragraph tree */
+/**********************/
+
+static unsigned CPTotalLength(CPParagraphNode *node)
+{
+    return (node == NULL) ? 0 : node->total;
+}
+
+static unsigned CPTotalCount(CPParagraphNode *node)
+{
+    return (node == NULL) ? 0 : node->count;
+}
+
+static void CPUpdateTotals(CPParagraphNode *node)
+{
+    node->total = node->statistics.length + CPTotalLength(node->left) + CPTotalLength(node->right);
+    node->count = 1 + CPTotalCount(node->left) + CPTotalCount(node->right);
+}
+
+/***** The next random priority (see CPPieceTableStorage) *****/
+
+static unsigned CPNextPriority(unsigned long *seed)
+{
+    *seed = (*seed * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+    
+    return (unsigned)(*seed >> 1);
+}
+
+/***** Make a tree out of an array of paragraphs *****/
+
+/*
+ * This goes straight down the list, keeping track of the nodes
+ * down the right side of the tree, so it only takes one pass
+ * (joining them one at a time would take n log n steps).
+ */
+
+static CPParagraphNode *CPMakeParagraphTree(CPParagraphStatistics *list, unsigned count, unsigned long *seed)
+{
+    CPParagraphNode **rightSide;
+    CPParagraphNode *root;
+    unsigned depth = 0, i;
+    
+    if (count == 0)
+        return NULL;
+    
+    rightSide = malloc(count * sizeof(CPParagraphNode *));
+    
+    for (i = 0; i < count; i++)
+    {
+        CPParagraphNode *node = malloc(sizeof(CPParagraphNode));
+        CPParagraphNode *below = NULL;
+        
+        node->left = NULL;
+        node->right = NULL;
+        node->priority = CPNextPriority(seed);
+        node->statistics = list[i];
+        
+        // Anything on the right side with a lower priority goes under the new node
+        
+        while (depth > 0 && rightSide[depth - 1]->priority < node->priority)
+        {
+            below = rightSide[--depth];
+            CPUpdateTotals(below);  // Nothing else will be added under it
+        }
+        
+        node->left = below;
+        
+        if (depth > 0)
+            rightSide[depth - 1]->right = node;
+        
+        rightSide[depth++] = node;
+    }
+    
+    root = rightSide[0];
+    
+    while (depth > 0)
+        CPUpdateTotals(rightSide[--depth]);
+    
+    free(rightSide);
+    
+    return root;
+}
+
+/***** Free a tree, taking its paragraphs out of the totals *****/
+
+static void CPRemoveParagraphs(CPParagraphNode *node, unsigned *characters, unsigned *words, unsigned *paragraphs, unsigned *lines)
+{
+    if (node == NULL)
+        return;
+    
+    CPRemoveParagraphs(node->left, characters, words, paragraphs, lines);
+    CPRemoveParagraphs(node->right, characters, words, paragraphs, lines);
+    
+    if (characters != NULL)
+        CPAddParagraph(&node->statistics, characters, words, paragraphs, lines, -1);
+    
+    free(node);
+}
+
+/***** Join two trees (everything in left comes first) *****/
+
+static CPParagraphNode *CPJoinParagraphs(CPParagraphNode *left, CPParagraphNode *right)
+{
+    if (left == NULL)
+        return right;
+    
+    if (right == NULL)
+        return left;
+    
+    if (left->priority > right->priority)
+    {
+        left->right = CPJoinParagraphs(left->right, right);
+        CPUpdateTotals(left);
+        
+        return left;
+    }
+    
+    else
+    {
+        right->left = CPJoinParagraphs(left, right->left);
+        CPUpdateTotals(right);
+        
+        return right;
+    }
+}
+
+/***** Split a tree so the first index paragraphs are in left *****/
+
+static void CPSplitParagraphs(CPParagraphNode *node, unsigned index, CPParagraphNode **left, CPParagraphNode **right)
+{
+    unsigned leftCount;
+    
+    if (node == NULL)
+    {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+    
+    leftCount = CPTotalCount(node->left);
+    
+    if (index <= leftCount)
+    {
+        CPSplitParagraphs(node->left, index, left, &node->left);
+        CPUpdateTotals(node);
+        *right = node;
+    }
+    
+    else
+    {
+        CPSplitParagraphs(node->right, index - leftCount - 1, &node->right, right);
+        CPUpdateTotals(node);
+        *left = node;
+    }
+}
+
+/***** Find the paragraph a character is in *****/
+
+/*
+ * Anything at (or past) the end of the text is in the last
+ * paragraph.  *start is set to where the paragraph starts, and
+ * *index to which one it is.
+ */
+
+static CPParagraphNode *CPParagraphAtLocation(CPParagraphNode *node, unsigned location, unsigned *start, unsigned *index)
+{
+    unsigned offset = 0, before = 0;
+    
+    if (location >= CPTotalLength(node))
+    {
+        // The last one (which might be empty)
+        
+        while (node->right != NULL)
+        {
+            before += CPTotalCount(node->left) + 1;
+            offset += CPTotalLength(node->left) + node->statistics.length;
+            node = node->right;
+        }
+        
+        *start = offset + CPTotalLength(node->left);
+        *index = before + CPTotalCount(node->left);
+        
+        return node;
+    }
+    
+    while (YES)
+    {
+        unsigned leftLength = CPTotalLength(node->left);
+        
+        if (location < offset + leftLength)
+        {
+            node = node->left;
+        }
+        
+        else if (location < offset + leftLength + node->statistics.length)
+        {
+            *start = offset + leftLength;
+            *index = before + CPTotalCount(node->left);
+            
+            return node;
+        }
+        
+        else
+        {
+            offset += leftLength + node->statistics.length;
+            before += CPTotalCount(node->left) + 1;
+            node = node->right;
+        }
+    }
+}
+
+
+@implementation CPDocumentStatistics
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
++ (void)initialize
+{
+    unsigned i;
+    
+    if (self != [CPDocumentStatistics class])
+        return;
+    
+    for (i = 0; i < 128; i++)
+    {
+        if ((i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z') || (i >= '0' && i <= '9'))
+            CPCharacterClasses[i] = CPWordCharacter;
+        
+        else
+            CPCharacterClasses[i] = CPSpaceCharacter;
+    }
+    
+    CPCharacterClasses['\''] = CPJoinerCharacter;
+    CPCharacterClasses['\n'] = CPParagraphBreakCharacter;
+    CPCharacterClasses['\r'] = CPParagraphBreakCharacter;
+    
+    CPWordCharacters = [[NSCharacterSet alphanumericCharacterSet] retain];
+}
+
+- (id)initWithTextStorage:(NSTextStorage *)storage
+{
+    if (self = [super init])
+    {
+        textStorage = storage;
+        
+        [self recount];
+        
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(textStorageDidProcessEditing:) name:NSTextStorageDidProcessEditingNotification object:textStorage];
+    }
+    
+    return self;
+}
+
+/********************/
+/* Accessor methods */
+/********************/
+
+- (unsigned)characterCount
+{
+    return characters;
+}
+
+- (unsigned)wordCount
+{
+    return words;
+}
+
+- (unsigned)paragraphCount
+{
+    return nonEmptyParagraphs;
+}
+
+- (unsigned)lineCount
+{
+    return lines;
+}
+
+/********************/
+/* Counting methods */
+/********************/
+
+/***** Count the paragraphs in part of the text *****/
+
+/*
+ * The range has to start at the beginning of a paragraph.  Returns
+ * a malloc'ed array (the caller frees it).  The text at the very
+ * end of the document always gets an entry, even if it's empty, so
+ * there's somewhere to put whatever gets typed there.
+ */
+
+- (CPParagraphStatistics *)scanRange:(NSRange)range count:(unsigned *)count
+{
+    NSString *string = [textStorage string];
+    unichar buffer[CP_ScanBufferLength];
+    unsigned capacity = 16;
+    CPParagraphStatistics *result = malloc(capacity * sizeof(CPParagraphStatistics));
+    CPParagraphStatistics current = {0, 0, 0};
+    unsigned location = range.location;
+    unsigned end = NSMaxRange(range);
+    BOOL inWord = NO;
+    BOOL afterReturn = NO;  // So \r\n counts as one paragraph break
+    
+    *count = 0;
+    
+    while (location < end)
+    {
+        unsigned length = MIN(CP_ScanBufferLength, end - location);
+        unsigned i;
+        
+        [string getCharacters:buffer range:NSMakeRange(location, length)];
+        
+        for (i = 0; i < length; i++)
+        {
+            unichar character = buffer[i];
+            
+            if (character == '\n' && afterReturn)
+            {
+                result[*count - 1].length++;  // It goes with the return we just saw
+                afterReturn = NO;
+                continue;
+            }
+            
+            afterReturn = NO;
+            current.length++;
+            
+            switch (CPClassOfCharacter(character))
+            {
+                case CPWordCharacter:
+                    if (!inWord)
+                    {
+                        current.words++;
+                        inWord = YES;
+                    }
+                    break;
+                
+                case CPJoinerCharacter:
+                    break;  // Doesn't start or end a word
+                
+                case CPLineBreakCharacter:
+                    current.lineBreaks++;
+                    inWord = NO;
+                    break;
+                
+                case CPParagraphBreakCharacter:
+                    if (*count == capacity)
+                    {
+                        capacity *= 2;
+                        result = realloc(result, capacity * sizeof(CPParagraphStatistics));
+                    }
+                    
+                    result[(*count)++] = current;
+                    current.length = current.words = current.lineBreaks = 0;
+                    
+                    afterReturn = (character == '\r');
+                    inWord = NO;
+                    break;
+                
+                default:
+                    inWord = NO;
+                    break;
+            }
+        }
+        
+        location += length;
+    }
+    
+    // Whatever's left after the last paragraph break
+    
+    if (current.length > 0 || end == [string length])
+    {
+        if (*count == capacity)
+        {
+            capacity++;
+            result = realloc(result, capacity * sizeof(CPParagraphStatistics));
+        }
+        
+        result[(*count)++] = current;
+    }
+    
+    return result;
+}
+
+/***** Count everything from scratch *****/
+
+- (void)recount
+{
+    CPParagraphStatistics *list;
+    unsigned count, i;
+    
+    CPRemoveParagraphs(paragraphs, NULL, NULL, NULL, NULL);
+    
+    list = [self scanRange:NSMakeRange(0, [textStorage length]) count:&count];
+    paragraphs = CPMakeParagraphTree(list, count, &seed);
+    
+    characters = words = nonEmptyParagraphs = lines = 0;
+    
+    for (i = 0; i < count; i++)
+    {
+        CPAddParagraph(&list[i], &characters, &words, &nonEmptyParagraphs, &lines, 1);
+    }
+    
+    free(list);
+}
+
+/***** Count the paragraphs that were just edited *****/
+
+/*
+ * The edited range and change in length tell us which part of the
+ * old text was replaced.  We find the paragraphs it touched, add
+ * the one before and the one after, and count just those again.
+ * Finding them is a trip down the tree, which is a lot cheaper than
+ * looking at the characters (or at every paragraph before them).
+ */
+
+- (void)textStorageDidProcessEditing:(NSNotification *)notification
+{
+    NSRange editedRange = [textStorage editedRange];
+    int delta = [textStorage changeInLength];
+    unsigned oldStart, oldEnd, regionStart, regionEnd, position, first, last, count, i;
+    CPParagraphNode *paragraph, *before, *edited, *after;
+    CPParagraphStatistics *newParagraphs;
+    unsigned newCount;
+    
+    if (!([textStorage editedMask] & NSTextStorageEditedCharacters))
+        return;  // Only the attributes changed
+    
+    // If we somehow got out of step, just start over
+    
+    if (paragraphs == NULL || characters + delta != [textStorage length])
+    {
+        [self recount];
+        return;
+    }
+    
+    count = CPTotalCount(paragraphs);
+    oldStart = editedRange.location;
+    oldEnd = NSMaxRange(editedRange) - delta;
+    
+    // Find the paragraph where the edit starts, and back up one
+    
+    CPParagraphAtLocation(paragraphs, oldStart, &regionStart, &first);
+    
+    if (first > 0)
+        CPParagraphAtLocation(paragraphs, regionStart - 1, &regionStart, &first);
+    
+    // Find the paragraph where the edit ends, and go one more
+    
+    paragraph = CPParagraphAtLocation(paragraphs, oldEnd, &position, &last);
+    regionEnd = position + paragraph->statistics.length;
+    
+    if (last + 1 < count)
+    {
+        last++;
+        
+        if (regionEnd < characters)
+            regionEnd += CPParagraphAtLocation(paragraphs, regionEnd, &position, &i)->statistics.length;
+    }
+    
+    // If that's the end of the document, take the empty paragraph at the
+    // very end too (the new count comes with its own)
+    
+    if (regionEnd + delta == [textStorage length])
+        last = count - 1;
+    
+    // Count them again
+    
+    newParagraphs = [self scanRange:NSMakeRange(regionStart, regionEnd + delta - regionStart) count:&newCount];
+    
+    // Swap the new paragraphs in for the old ones
+    
+    CPSplitParagraphs(paragraphs, first, &before, &edited);
+    CPSplitParagraphs(edited, last - first + 1, &edited, &after);
+    
+    CPRemoveParagraphs(edited, &characters, &words, &nonEmptyParagraphs, &lines);
+    
+    for (i = 0; i < newCount; i++)
+        CPAddParagraph(&newParagraphs[i], &characters, &words, &nonEmptyParagraphs, &lines, 1);
+    
+    edited = CPMakeParagraphTree(newParagraphs, newCount, &seed);
+    paragraphs = CPJoinParagraphs(CPJoinParagraphs(before, edited), after);
+    
+    free(newParagraphs);
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    
+    CPRemoveParagraphs(paragraphs, NULL, NULL, NULL, NULL);
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
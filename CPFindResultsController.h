@@ -0,0 +1,41 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPFindResultsController.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPFindResultsController class.  See "CPFindResultsController.m"
+ for info on the CPFindResultsController class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+@interface CPFindResultsController : NSObject
+{
+    NSPanel *panel;  // Made the first time there's something to show
+    NSTextField *summaryField;
+    NSTableView *tableView;
+    
+    NSMutableArray *matches;  // One dictionary for each row
+}
+
++ (CPFindResultsController *)sharedController;
+
+// Showing the matches (one NSData full of NSRanges for each document)
+
+- (void)showMatches:(NSArray *)rangeLists inDocuments:(NSArray *)documents summary:(NSString *)summary;
+
+// Documents take their matches out when they're closed
+
+- (void)forgetDocument:(id)document;
+
+// The table's action
+
+- (void)showMatch:(id)sender;
+
+@end
@@ -0,0 +1,285 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPFindResultsController.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Lists the matches Find All and Find in All Documents came up with.
+ 
+ Selecting every match at once only works on Mac OS X 10.4 Tiger and up,
+ and even there, it doesn't tell you where they are.  So both of them also
+ put their matches in this panel: which document each one is in, what line
+ it's on, and the text around it.  Clicking one brings its document to the
+ front and selects it.
+ 
+ The panel doesn't keep the documents around, so when a document is
+ closed, it takes its matches out of the list (see forgetDocument:).  If
+ it's been edited, the match might not be where it was anymore --
+ searching again fixes that.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: Closed documents' matches are taken out of the list, instead
+             of checking whether the document's still open when one is
+             clicked (a new document could end up at the same address).
+ 
+ */
+
+#import "CPFindResultsController.h"
+#import "MyDocument.h"
+#import "LocalizedStrings.h"
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_MaxListedMatches 1000  // More than that isn't much use in a list
+#define CP_ContextBefore 30  // Characters of the line shown before the match
+#define CP_ContextAfter 50  // ...and after it
+
+// Keys in each row
+
+static NSString *CP_MatchDocumentKey = @"Document";  // Not retained (an NSValue)
+static NSString *CP_MatchNameKey = @"Name";
+static NSString *CP_MatchRangeKey = @"Range";
+static NSString *CP_MatchLineKey = @"Line";
+static NSString *CP_MatchTextKey = @"Text";
+
+
+@implementation CPFindResultsController
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+/***** The panel everybody shares *****/
+
++ (CPFindResultsController *)sharedController
+{
+    static CPFindResultsController *sharedController = nil;
+    
+    if (sharedController == nil)
+    {
+        sharedController = [[CPFindResultsController alloc] init];
+    }
+    
+    return sharedController;
+}
+
+- (id)init
+{
+    if (self = [super init])
+    {
+        matches = [[NSMutableArray alloc] init];
+    }
+    
+    return self;
+}
+
+/***** Make the panel *****/
+
+- (void)makePanel
+{
+    NSScrollView *scrollView;
+    NSTableColumn *column;
+    NSView *content;
+    
+    panel = [[NSPanel alloc] initWithContentRect:NSMakeRect(0, 0, 520, 300) styleMask:NSTitledWindowMask | NSClosableWindowMask | NSResizableWindowMask | NSUtilityWindowMask backing:NSBackingStoreBuffered defer:YES];
+    [panel setTitle:L_FIND_RESULTS_TITLE];
+    [panel setReleasedWhenClosed:NO];  // We keep it for next time
+    content = [panel contentView];
+    
+    summaryField = [[NSTextField alloc] initWithFrame:NSMakeRect(12, 274, 496, 17)];
+    [summaryField setEditable:NO];
+    [summaryField setSelectable:NO];
+    [summaryField setBezeled:NO];
+    [summaryField setDrawsBackground:NO];
+    [summaryField setAutoresizingMask:NSViewWidthSizable | NSViewMinYMargin];
+    [content addSubview:summaryField];
+    
+    scrollView = [[[NSScrollView alloc] initWithFrame:NSMakeRect(0, 0, 520, 266)] autorelease];
+    [scrollView setHasVerticalScroller:YES];
+    [scrollView setBorderType:NSBezelBorder];
+    [scrollView setAutoresizingMask:NSViewWidthSizable | NSViewHeightSizable];
+    
+    tableView = [[NSTableView alloc] initWithFrame:[[scrollView contentView] bounds]];
+    
+    column = [[[NSTableColumn alloc] initWithIdentifier:CP_MatchNameKey] autorelease];
+    [[column headerCell] setStringValue:L_FIND_RESULTS_DOCUMENT_COLUMN];
+    [column setWidth:120];
+    [column setEditable:NO];
+    [tableView addTableColumn:column];
+    
+    column = [[[NSTableColumn alloc] initWithIdentifier:CP_MatchLineKey] autorelease];
+    [[column headerCell] setStringValue:L_FIND_RESULTS_LINE_COLUMN];
+    [column setWidth:50];
+    [column setEditable:NO];
+    [tableView addTableColumn:column];
+    
+    column = [[[NSTableColumn alloc] initWithIdentifier:CP_MatchTextKey] autorelease];
+    [[column headerCell] setStringValue:L_FIND_RESULTS_TEXT_COLUMN];
+    [column setWidth:320];
+    [column setEditable:NO];
+    [tableView addTableColumn:column];
+    
+    [tableView setDataSource:self];
+    [tableView setTarget:self];
+    [tableView setAction:@selector(showMatch:)];
+    
+    [scrollView setDocumentView:tableView];
+    [content addSubview:scrollView];
+    
+    [panel center];
+}
+
+/********************/
+/* Showing the list */
+/********************/
+
+/***** Fill the list with the matches, and show it *****/
+
+/*
+ * The line numbers are counted as we go through each document's
+ * matches in order, so every document's text is only walked once.
+ */
+
+- (void)showMatches:(NSArray *)rangeLists inDocuments:(NSArray *)documents summary:(NSString *)summary
+{
+    unsigned total = 0, i;
+    
+    [matches removeAllObjects];
+    
+    for (i = 0; i < [documents count] && [matches count] < CP_MaxListedMatches; i++)
+    {
+        MyDocument *document = [documents objectAtIndex:i];
+        NSData *ranges = [rangeLists objectAtIndex:i];
+        const NSRange *list = [ranges bytes];
+        unsigned count = [ranges length] / sizeof(NSRange);
+        NSString *string = [[document textView] string];
+        unsigned lineStart = 0, lineEnd = 0, contentsEnd = 0, line = 0, j;
+        
+        total += count;
+        
+        for (j = 0; j < count && [matches count] < CP_MaxListedMatches; j++)
+        {
+            NSRange range = list[j];
+            unsigned contextStart, contextEnd;
+            
+            // Move up to the line the match starts on
+            
+            while (line == 0 || lineEnd <= range.location)
+            {
+                [string getLineStart:&lineStart end:&lineEnd contentsEnd:&contentsEnd forRange:NSMakeRange(lineEnd, 0)];
+                line++;
+                
+                if (lineEnd >= [string length])
+                    break;  // The last line
+            }
+            
+            contextStart = (range.location > lineStart + CP_ContextBefore) ? range.location - CP_ContextBefore : lineStart;
+            contextEnd = MAX(MIN(NSMaxRange(range) + CP_ContextAfter, contentsEnd), contextStart);  // Matches can run past the end of the line
+            
+            [matches addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                [NSValue valueWithNonretainedObject:document], CP_MatchDocumentKey,
+                [NSValue valueWithRange:range], CP_MatchRangeKey,
+                [NSNumber numberWithUnsignedInt:line], CP_MatchLineKey,
+                [string substringWithRange:NSMakeRange(contextStart, contextEnd - contextStart)], CP_MatchTextKey,
+                [document displayName], CP_MatchNameKey,
+                nil]];
+        }
+    }
+    
+    for (; i < [rangeLists count]; i++)
+    {
+        total += [[rangeLists objectAtIndex:i] length] / sizeof(NSRange);
+    }
+    
+    if (panel == nil)
+        [self makePanel];
+    
+    if (total > [matches count])
+        summary = [NSString stringWithFormat:L_FIND_RESULTS_LIMIT_TEXT, summary, [matches count]];
+    
+    [summaryField setStringValue:summary];
+    [tableView reloadData];
+    [tableView deselectAll:nil];
+    
+    [panel orderFront:nil];
+}
+
+/***** Take out a document's matches (it's being closed) *****/
+
+- (void)forgetDocument:(id)document
+{
+    unsigned count = [matches count];
+    int i;
+    
+    for (i = count - 1; i >= 0; i--)
+    {
+        if ([[[matches objectAtIndex:i] objectForKey:CP_MatchDocumentKey] nonretainedObjectValue] == document)
+            [matches removeObjectAtIndex:i];
+    }
+    
+    if ([matches count] != count)
+    {
+        [tableView deselectAll:nil];
+        [tableView reloadData];
+    }
+}
+
+/***** Go to the match that was clicked *****/
+
+- (void)showMatch:(id)sender
+{
+    int row = [tableView selectedRow];
+    NSDictionary *match;
+    MyDocument *document;
+    NSRange range;
+    
+    if (row < 0 || row >= (int)[matches count])
+        return;
+    
+    match = [matches objectAtIndex:row];
+    document = [[match objectForKey:CP_MatchDocumentKey] nonretainedObjectValue];
+    range = [[match objectForKey:CP_MatchRangeKey] rangeValue];
+    
+    // It might have been cut down since (closed documents aren't in the list)
+    
+    if (NSMaxRange(range) > [[[document textView] string] length])
+    {
+        NSBeep();
+        return;
+    }
+    
+    [[document currentWindow] makeKeyAndOrderFront:nil];
+    [[document textView] setSelectedRange:range];
+    [[document textView] scrollRangeToVisible:range];
+}
+
+/**************************/
+/* Table view data source */
+/**************************/
+
+- (int)numberOfRowsInTableView:(NSTableView *)aTableView
+{
+    return [matches count];
+}
+
+- (id)tableView:(NSTableView *)aTableView objectValueForTableColumn:(NSTableColumn *)column row:(int)row
+{
+    return [[matches objectAtIndex:row] objectForKey:[column identifier]];
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [matches release];
+    [tableView release];
+    [summaryField release];
+    [panel release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
@@ -0,0 +1,60 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPPieceTableStorage.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPPieceTableStorage class.  See "CPPieceTableStorage.m" for
+ info on the CPPieceTableStorage class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+struct CPPiece;
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+@interface CPPieceTableStorage : NSTextStorage
+{
+    NSString *string;  // Reads straight out of the pieces (never a copy)
+    struct CPPiece *root;  // The pieces, in order (see the top of the .m file)
+    unsigned pieceCount;
+    unsigned long prioritySeed;  // Our own random numbers, so we don't change anyone else's random()
+    
+    // The text we were opened with (this never changes)
+    
+    NSData *original;  // The memory mapped file, or the characters we decoded from it
+    const unsigned char *originalBytes;  // ASCII or Latin 1 -- one byte per character
+    const unichar *originalCharacters;  // Everything else
+    
+    // Everything that's been typed or pasted since (only ever added to)
+    
+    unichar *added;
+    unsigned addedLength;
+    unsigned addedCapacity;
+    
+    NSDictionary *emptyAttributes;  // What new text gets when there's nothing to take them from
+    
+    // The last piece we read from (text is usually read in order)
+    
+    struct CPPiece *cachedPiece;
+    unsigned cachedStart;
+}
+
+- (id)initWithData:(NSData *)data encoding:(NSStringEncoding)encoding headerLength:(unsigned)headerLength attributes:(NSDictionary *)attributes;
+
+// Reading the text (the string uses these)
+
+- (unichar)characterAtIndex:(unsigned)index;
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range;
+- (struct CPPiece *)pieceAtIndex:(unsigned)index start:(unsigned *)start;  // start is set to where the piece starts
+- (unsigned)pieceCount;
+
+// Saving
+
+- (BOOL)writeToFile:(NSString *)path encoding:(NSStringEncoding)encoding;  // A piece at a time (never writes over the original file)
+
+@end
@@ -0,0 +1,865 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPPieceTableStorage.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ The text storage for plain text files.  Instead of keeping the characters
+ in one big buffer (which has to be moved around every time something is
+ typed in the middle, and copied whenever somebody wants the string), it
+ keeps a list of "pieces".  Each piece is a run of characters out of one
+ of two places:
+ 
+ - The original text, which is the (memory mapped) file itself if it's
+   ASCII or Latin 1, and is never changed.  Any other encoding is decoded
+   once, and then the file is let go.
+ - The added text, which is everything that's been typed or pasted since.
+   New text always goes on the end of it, and nothing is ever taken out.
+ 
+ So typing just adds to the end of the added text and puts a new piece in
+ the list, and deleting just takes pieces out (or shortens them).  Nothing
+ is ever moved or copied, no matter how big the file is.
+ 
+ The pieces are kept in a balanced tree (a "treap" -- each piece gets a
+ random priority, and the tree is kept in heap order by it, which keeps it
+ balanced on average).  Every piece knows how many characters are under it,
+ so finding the piece for a character, splitting the tree at a character,
+ and joining two trees all take O(log n) time, where n is the number of
+ pieces.  Each piece has its own attributes, which is all plain text needs
+ (it's all one font and color, so there's usually only one dictionary).
+ 
+ The string we hand out reads straight out of the pieces, so there's no
+ second copy of the text anywhere.  Saving goes a piece at a time too, and
+ ASCII and Latin 1 pieces are written straight out of the original file.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: The priorities come from our own random number generator, so
+             making pieces doesn't change the numbers random() hands out.
+ 
+ */
+
+#import "CPPieceTableStorage.h"
+#import "CPDocumentCodec.h"
+
+// For rename(), unlink(), and getpid()
+#import <stdio.h>
+#import <unistd.h>
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_DecodeChunkLength (1024 * 1024)  // How much of a file we decode at a time (in bytes)
+#define CP_MinimumAddedCapacity 4096  // In characters
+#define CP_WriteBufferLength (32 * 1024)  // How many characters we encode at a time when saving
+
+/*********/
+/* Types */
+/*********/
+
+// One run of characters (see the top of the file)
+
+typedef struct CPPiece
+{
+    struct CPPiece *left;  // The pieces before this one...
+    struct CPPiece *right;  // ...and after it
+    unsigned priority;  // Keeps the tree balanced
+    BOOL isAdded;  // Is it out of the added text (or the original)?
+    unsigned start;  // Where it starts in that text
+    unsigned length;
+    unsigned total;  // How many characters are in this piece and everything under it
+    NSDictionary *attributes;
+} CPPiece;
+
+// Everything we need while saving
+
+typedef struct
+{
+    FILE *file;
+    NSStringEncoding encoding;
+    const unsigned char *originalBytes;
+    const unichar *originalCharacters;
+    const unichar *added;
+    unichar *buffer;  // Characters waiting to be encoded
+    unsigned count;
+    BOOL failed;
+} CPPieceWriter;
+
+/******************/
+/* The piece tree */
+/******************/
+
+static unsigned CPTotalLength(CPPiece *piece)
+{
+    return (piece == NULL) ? 0 : piece->total;
+}
+
+static void CPUpdateTotal(CPPiece *piece)
+{
+    piece->total = piece->length + CPTotalLength(piece->left) + CPTotalLength(piece->right);
+}
+
+/***** The next random priority *****/
+
+/*
+ * A plain linear congruential generator (the one from the C
+ * standard), with each storage keeping its own seed.  random()
+ * would work just as well, but then anyone else using it (like
+ * cpbench's random edits) would get different numbers depending
+ * on how many pieces we happened to make.
+ */
+
+static unsigned CPNextPriority(unsigned long *seed)
+{
+    *seed = (*seed * 1103515245UL + 12345UL) & 0xFFFFFFFFUL;
+    
+    return (unsigned)(*seed >> 1);
+}
+
+static CPPiece *CPNewPiece(BOOL isAdded, unsigned start, unsigned length, NSDictionary *attributes, unsigned long *seed)
+{
+    CPPiece *piece = malloc(sizeof(CPPiece));
+    
+    piece->left = NULL;
+    piece->right = NULL;
+    piece->priority = CPNextPriority(seed);
+    piece->isAdded = isAdded;
+    piece->start = start;
+    piece->length = length;
+    piece->total = length;
+    piece->attributes = [attributes retain];
+    
+    return piece;
+}
+
+static unsigned CPFreePieces(CPPiece *piece)
+{
+    unsigned count;
+    
+    if (piece == NULL)
+        return 0;
+    
+    count = 1 + CPFreePieces(piece->left) + CPFreePieces(piece->right);
+    
+    [piece->attributes release];
+    free(piece);
+    
+    return count;
+}
+
+/***** Join two trees (everything in left comes first) *****/
+
+static CPPiece *CPJoinPieces(CPPiece *left, CPPiece *right)
+{
+    if (left == NULL)
+        return right;
+    
+    if (right == NULL)
+        return left;
+    
+    if (left->priority > right->priority)
+    {
+        left->right = CPJoinPieces(left->right, right);
+        CPUpdateTotal(left);
+        
+        return left;
+    }
+    
+    else
+    {
+        right->left = CPJoinPieces(left, right->left);
+        CPUpdateTotal(right);
+        
+        return right;
+    }
+}
+
+/***** Split a tree so the first location characters are in left *****/
+
+/*
+ * If location is in the middle of a piece, the piece is cut in two,
+ * and *cut goes up by one (so the caller can keep count).
+ */
+
+static void CPSplitPieces(CPPiece *piece, unsigned location, CPPiece **left, CPPiece **right, unsigned *cut, unsigned long *seed)
+{
+    unsigned leftLength;
+    
+    if (piece == NULL)
+    {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+    
+    leftLength = CPTotalLength(piece->left);
+    
+    if (location <= leftLength)
+    {
+        CPSplitPieces(piece->left, location, left, &piece->left, cut, seed);
+        CPUpdateTotal(piece);
+        *right = piece;
+    }
+    
+    else if (location >= leftLength + piece->length)
+    {
+        CPSplitPieces(piece->right, location - leftLength - piece->length, &piece->right, right, cut, seed);
+        CPUpdateTotal(piece);
+        *left = piece;
+    }
+    
+    else
+    {
+        // Cut the piece, and the second half goes on the right
+        
+        unsigned offset = location - leftLength;
+        CPPiece *tail = CPNewPiece(piece->isAdded, piece->start + offset, piece->length - offset, piece->attributes, seed);
+        
+        *right = CPJoinPieces(tail, piece->right);
+        
+        piece->length = offset;
+        piece->right = NULL;
+        CPUpdateTotal(piece);
+        *left = piece;
+        
+        (*cut)++;
+    }
+}
+
+/***** Find the piece a character is in *****/
+
+static CPPiece *CPPieceAtIndex(CPPiece *piece, unsigned index, unsigned *start)
+{
+    unsigned offset = 0;
+    
+    while (piece != NULL)
+    {
+        unsigned leftLength = CPTotalLength(piece->left);
+        
+        if (index < offset + leftLength)
+        {
+            piece = piece->left;
+        }
+        
+        else if (index < offset + leftLength + piece->length)
+        {
+            *start = offset + leftLength;
+            return piece;
+        }
+        
+        else
+        {
+            offset += leftLength + piece->length;
+            piece = piece->right;
+        }
+    }
+    
+    return NULL;
+}
+
+static void CPSetPieceAttributes(CPPiece *piece, NSDictionary *attributes)
+{
+    if (piece == NULL)
+        return;
+    
+    if (piece->attributes != attributes)
+    {
+        [attributes retain];
+        [piece->attributes release];
+        piece->attributes = attributes;
+    }
+    
+    CPSetPieceAttributes(piece->left, attributes);
+    CPSetPieceAttributes(piece->right, attributes);
+}
+
+static BOOL CPSameAttributes(NSDictionary *first, NSDictionary *second)
+{
+    return (first == second || [first isEqualToDictionary:second]);
+}
+
+/*****************************/
+/* Reading and writing bytes */
+/*****************************/
+
+/***** Is it all ASCII? *****/
+
+/*
+ * A word at a time, since this goes through the whole file
+ * when it's opened.
+ */
+
+static BOOL CPBytesAreASCII(const unsigned char *bytes, unsigned length)
+{
+    const unsigned char *end = bytes + length;
+    
+    while (bytes < end && ((unsigned long)bytes % sizeof(unsigned long)) != 0)
+    {
+        if (*bytes++ & 0x80)
+            return NO;
+    }
+    
+    while (bytes + sizeof(unsigned long) <= end)
+    {
+        if (*(const unsigned long *)bytes & ((unsigned long)-1 / 0xFF * 0x80))  // 0x8080...80
+            return NO;
+        
+        bytes += sizeof(unsigned long);
+    }
+    
+    while (bytes < end)
+    {
+        if (*bytes++ & 0x80)
+            return NO;
+    }
+    
+    return YES;
+}
+
+/***** Encode and write out the characters we've saved up *****/
+
+/*
+ * Unless this is the last time, a surrogate pair at the end is
+ * held back until we have both halves.
+ */
+
+static void CPFlushWriter(CPPieceWriter *writer, BOOL final)
+{
+    unsigned count = writer->count;
+    
+    if (!final && count > 0 && writer->buffer[count - 1] >= 0xD800 && writer->buffer[count - 1] <= 0xDBFF)
+        count--;
+    
+    if (count > 0 && !writer->failed)
+    {
+        if (writer->encoding == NSUnicodeStringEncoding)
+        {
+            // The byte order mark was written first, so these go out as they are
+            
+            writer->failed = (fwrite(writer->buffer, sizeof(unichar), count, writer->file) != count);
+        }
+        
+        else
+        {
+            NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+            NSString *chunk = [[NSString alloc] initWithCharactersNoCopy:writer->buffer length:count freeWhenDone:NO];
+            NSData *data = [chunk dataUsingEncoding:writer->encoding allowLossyConversion:YES];
+            
+            writer->failed = (data == nil || fwrite([data bytes], 1, [data length], writer->file) != [data length]);
+            
+            [chunk release];
+            [pool release];
+        }
+    }
+    
+    memmove(writer->buffer, writer->buffer + count, (writer->count - count) * sizeof(unichar));
+    writer->count -= count;
+}
+
+/***** Write out one piece (and everything under it, in order) *****/
+
+static void CPWritePieces(CPPiece *piece, CPPieceWriter *writer)
+{
+    if (piece == NULL || writer->failed)
+        return;
+    
+    CPWritePieces(piece->left, writer);
+    
+    if (!piece->isAdded && writer->originalBytes != NULL && (writer->encoding == NSISOLatin1StringEncoding || ((writer->encoding == NSUTF8StringEncoding || writer->encoding == NSASCIIStringEncoding) && CPBytesAreASCII(writer->originalBytes + piece->start, piece->length))))
+    {
+        // It's already in the right encoding, so it goes straight from the file
+        
+        CPFlushWriter(writer, YES);
+        
+        if (!writer->failed)
+            writer->failed = (fwrite(writer->originalBytes + piece->start, 1, piece->length, writer->file) != piece->length);
+    }
+    
+    else
+    {
+        unsigned done = 0;
+        
+        while (done < piece->length && !writer->failed)
+        {
+            unsigned count = MIN(piece->length - done, CP_WriteBufferLength - writer->count);
+            unsigned location = piece->start + done;
+            unichar *buffer = writer->buffer + writer->count;
+            unsigned i;
+            
+            if (piece->isAdded)
+                memcpy(buffer, writer->added + location, count * sizeof(unichar));
+            
+            else if (writer->originalCharacters != NULL)
+                memcpy(buffer, writer->originalCharacters + location, count * sizeof(unichar));
+            
+            else
+            {
+                for (i = 0; i < count; i++)
+                    buffer[i] = writer->originalBytes[location + i];
+            }
+            
+            writer->count += count;
+            done += count;
+            
+            if (writer->count == CP_WriteBufferLength)
+                CPFlushWriter(writer, NO);
+        }
+    }
+    
+    CPWritePieces(piece->right, writer);
+}
+
+/**********************************************/
+/* The string (it just asks the text storage) */
+/**********************************************/
+
+@interface CPPieceTableString : NSString
+{
+    CPPieceTableStorage *storage;  // Not retained -- the storage owns us
+}
+
+- (id)initWithStorage:(CPPieceTableStorage *)aStorage;
+
+@end
+
+@implementation CPPieceTableString
+
+- (id)initWithStorage:(CPPieceTableStorage *)aStorage
+{
+    if (self = [super init])
+    {
+        storage = aStorage;
+    }
+    
+    return self;
+}
+
+- (unsigned)length
+{
+    return [storage length];
+}
+
+- (unichar)characterAtIndex:(unsigned)index
+{
+    return [storage characterAtIndex:index];
+}
+
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range
+{
+    [storage getCharacters:buffer range:range];
+}
+
+// The text changes under us, so a copy has to be a real one
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return [[NSString allocWithZone:zone] initWithString:self];
+}
+
+@end
+
+
+@implementation CPPieceTableStorage
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+- (id)init
+{
+    return [self initWithData:nil encoding:NSUTF8StringEncoding headerLength:0 attributes:nil];
+}
+
+/***** Start out with a plain text file *****/
+
+/*
+ * data should be memory mapped (that's the whole point), and
+ * encoding and headerLength are what CPDocumentCodec's
+ * encodingOfTextData:headerLength: came up with.  attributes
+ * are used for all of the text.
+ */
+
+- (id)initWithData:(NSData *)data encoding:(NSStringEncoding)encoding headerLength:(unsigned)headerLength attributes:(NSDictionary *)attributes
+{
+    if (self = [super init])
+    {
+        const unsigned char *bytes = [data bytes] + headerLength;
+        unsigned byteCount = ([data length] > headerLength) ? [data length] - headerLength : 0;
+        unsigned length = 0;
+        
+        string = [[CPPieceTableString alloc] initWithStorage:self];
+        emptyAttributes = (attributes != nil) ? [attributes copy] : [[NSDictionary alloc] init];
+        
+        if (byteCount == 0)
+        {
+            // Nothing to keep
+        }
+        
+        else if (encoding == NSISOLatin1StringEncoding || encoding == NSASCIIStringEncoding || (encoding == NSUTF8StringEncoding && CPBytesAreASCII(bytes, byteCount)))
+        {
+            // One byte is one character, so we can read right out of the file
+            
+            original = [data retain];
+            originalBytes = bytes;
+            length = byteCount;
+        }
+        
+        else
+        {
+            // Decode it once (there are never more characters than bytes)
+            
+            unsigned capacity = (encoding == NSUnicodeStringEncoding) ? byteCount / 2 : byteCount;
+            unichar *characters = malloc(MAX(capacity, 1U) * sizeof(unichar));
+            unsigned location = headerLength;
+            NSString *piece;
+            
+            do
+            {
+                NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+                
+                piece = [CPDocumentCodec stringFromTextData:data encoding:encoding location:&location maxLength:CP_DecodeChunkLength];
+                
+                if (piece != nil)
+                {
+                    unsigned count = MIN([piece length], capacity - length);
+                    
+                    [piece getCharacters:characters + length range:NSMakeRange(0, count)];
+                    length += count;
+                }
+                
+                [pool release];
+            }
+            while (piece != nil);
+            
+            characters = realloc(characters, MAX(length, 1U) * sizeof(unichar));
+            
+            original = [[NSData alloc] initWithBytesNoCopy:characters length:length * sizeof(unichar) freeWhenDone:YES];
+            originalCharacters = [original bytes];
+        }
+        
+        if (length > 0)
+        {
+            root = CPNewPiece(NO, 0, length, emptyAttributes, &prioritySeed);
+            pieceCount = 1;
+        }
+    }
+    
+    return self;
+}
+
+/*************************/
+/* NSTextStorage methods */
+/*************************/
+
+/*
+ * These are the methods every NSTextStorage subclass has to
+ * have.  Everything else NSTextStorage does goes through them.
+ */
+
+- (NSString *)string
+{
+    return string;
+}
+
+- (unsigned)length
+{
+    return CPTotalLength(root);
+}
+
+- (NSDictionary *)attributesAtIndex:(unsigned)index effectiveRange:(NSRangePointer)range
+{
+    unsigned start = 0;
+    CPPiece *piece = [self pieceAtIndex:index start:&start];
+    
+    if (range != NULL)
+        *range = NSMakeRange(start, piece->length);
+    
+    return piece->attributes;
+}
+
+/***** Replace some characters *****/
+
+/*
+ * The new characters go on the end of the added text, and get a
+ * piece of their own in between the pieces before and after the
+ * range (whatever was in the range is just dropped).  If the piece
+ * right before them was the last thing added, with the same
+ * attributes -- which is what happens when you type -- that piece
+ * just gets longer instead.
+ */
+
+- (void)replaceCharactersInRange:(NSRange)range withString:(NSString *)newString
+{
+    unsigned newLength = [newString length];
+    NSDictionary *attributes;
+    CPPiece *before, *middle, *after;
+    unsigned cut = 0;
+    
+    if (NSMaxRange(range) > [self length])
+    {
+        [NSException raise:NSRangeException format:@"%@: range %@ is out of bounds (length %u)", NSStringFromSelector(_cmd), NSStringFromRange(range), [self length]];
+    }
+    
+    // The new text gets the attributes of the first character being
+    // replaced, or the one before it, or the one after it
+    
+    if (range.length > 0)
+        attributes = [self attributesAtIndex:range.location effectiveRange:NULL];
+    
+    else if (range.location > 0)
+        attributes = [self attributesAtIndex:range.location - 1 effectiveRange:NULL];
+    
+    else if ([self length] > 0)
+        attributes = [self attributesAtIndex:0 effectiveRange:NULL];
+    
+    else
+        attributes = emptyAttributes;
+    
+    [[attributes retain] autorelease];  // The piece it came from might be about to go
+    
+    CPSplitPieces(root, range.location, &before, &middle, &cut, &prioritySeed);
+    CPSplitPieces(middle, range.length, &middle, &after, &cut, &prioritySeed);
+    pieceCount += cut;
+    pieceCount -= CPFreePieces(middle);
+    
+    if (newLength > 0)
+    {
+        CPPiece *last = before;
+        
+        // Make room in the added text
+        
+        if (addedLength + newLength > addedCapacity)
+        {
+            addedCapacity = MAX(MAX(addedCapacity * 2, addedLength + newLength), (unsigned)CP_MinimumAddedCapacity);
+            added = realloc(added, addedCapacity * sizeof(unichar));
+        }
+        
+        [newString getCharacters:added + addedLength range:NSMakeRange(0, newLength)];
+        
+        while (last != NULL && last->right != NULL)
+            last = last->right;
+        
+        if (last != NULL && last->isAdded && last->start + last->length == addedLength && CPSameAttributes(last->attributes, attributes))
+        {
+            // Every piece on the way down to it gets longer too
+            
+            CPPiece *piece;
+            
+            last->length += newLength;
+            
+            for (piece = before; piece != NULL; piece = piece->right)
+                piece->total += newLength;
+        }
+        
+        else
+        {
+            before = CPJoinPieces(before, CPNewPiece(YES, addedLength, newLength, attributes, &prioritySeed));
+            pieceCount++;
+        }
+        
+        addedLength += newLength;
+    }
+    
+    root = CPJoinPieces(before, after);
+    cachedPiece = NULL;
+    
+    [self edited:NSTextStorageEditedCharacters range:range changeInLength:(int)newLength - (int)range.length];
+}
+
+/***** Change the attributes of some characters *****/
+
+- (void)setAttributes:(NSDictionary *)attributes range:(NSRange)range
+{
+    CPPiece *before, *middle, *after;
+    unsigned start = 0;
+    unsigned cut = 0;
+    
+    if (NSMaxRange(range) > [self length])
+    {
+        [NSException raise:NSRangeException format:@"%@: range %@ is out of bounds (length %u)", NSStringFromSelector(_cmd), NSStringFromRange(range), [self length]];
+    }
+    
+    if (range.length == 0)
+        return;
+    
+    attributes = (attributes != nil) ? [[attributes copy] autorelease] : [NSDictionary dictionary];
+    
+    // The text system sets the typing attributes on everything that's
+    // typed, and they're usually the same as what's already there, so
+    // we don't have to cut the piece up for that
+    
+    {
+        CPPiece *piece = [self pieceAtIndex:range.location start:&start];
+        
+        if (NSMaxRange(range) <= start + piece->length && CPSameAttributes(piece->attributes, attributes))
+        {
+            [self edited:NSTextStorageEditedAttributes range:range changeInLength:0];
+            return;
+        }
+    }
+    
+    CPSplitPieces(root, range.location, &before, &middle, &cut, &prioritySeed);
+    CPSplitPieces(middle, range.length, &middle, &after, &cut, &prioritySeed);
+    pieceCount += cut;
+    
+    CPSetPieceAttributes(middle, attributes);
+    
+    root = CPJoinPieces(CPJoinPieces(before, middle), after);
+    cachedPiece = NULL;
+    
+    [self edited:NSTextStorageEditedAttributes range:range changeInLength:0];
+}
+
+/********************/
+/* Reading the text */
+/********************/
+
+/***** Find the piece a character is in *****/
+
+/*
+ * Text is usually read from start to finish, so we remember the
+ * last piece we found, and check it before going through the tree.
+ */
+
+- (struct CPPiece *)pieceAtIndex:(unsigned)index start:(unsigned *)start
+{
+    if (cachedPiece == NULL || index < cachedStart || index >= cachedStart + cachedPiece->length)
+    {
+        if (index >= [self length])
+        {
+            [NSException raise:NSRangeException format:@"%@: index %u is out of bounds (length %u)", NSStringFromSelector(_cmd), index, [self length]];
+        }
+        
+        cachedPiece = CPPieceAtIndex(root, index, &cachedStart);
+    }
+    
+    *start = cachedStart;
+    
+    return cachedPiece;
+}
+
+- (unichar)characterAtIndex:(unsigned)index
+{
+    unsigned start = 0;
+    CPPiece *piece = [self pieceAtIndex:index start:&start];
+    unsigned location = piece->start + (index - start);
+    
+    if (piece->isAdded)
+        return added[location];
+    
+    else if (originalBytes != NULL)
+        return originalBytes[location];
+    
+    else
+        return originalCharacters[location];
+}
+
+- (void)getCharacters:(unichar *)buffer range:(NSRange)range
+{
+    unsigned index = range.location;
+    unsigned end = NSMaxRange(range);
+    
+    if (end > [self length])
+    {
+        [NSException raise:NSRangeException format:@"%@: range %@ is out of bounds (length %u)", NSStringFromSelector(_cmd), NSStringFromRange(range), [self length]];
+    }
+    
+    while (index < end)
+    {
+        unsigned start = 0;
+        CPPiece *piece = [self pieceAtIndex:index start:&start];
+        unsigned offset = index - start;
+        unsigned count = MIN(piece->length - offset, end - index);
+        unsigned location = piece->start + offset;
+        unsigned i;
+        
+        if (piece->isAdded)
+            memcpy(buffer, added + location, count * sizeof(unichar));
+        
+        else if (originalBytes != NULL)
+        {
+            for (i = 0; i < count; i++)
+                buffer[i] = originalBytes[location + i];
+        }
+        
+        else
+            memcpy(buffer, originalCharacters + location, count * sizeof(unichar));
+        
+        buffer += count;
+        index += count;
+    }
+}
+
+- (unsigned)pieceCount
+{
+    return pieceCount;
+}
+
+/**********/
+/* Saving */
+/**********/
+
+/*
+ * The file is written under a temporary name next to path, and then
+ * renamed over it.  That way, if path is the file we were opened
+ * with, the pages we still have mapped from it never change.
+ */
+
+- (BOOL)writeToFile:(NSString *)path encoding:(NSStringEncoding)encoding
+{
+    NSString *temporaryPath = [[path stringByDeletingLastPathComponent] stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.%d", [path lastPathComponent], getpid()]];
+    CPPieceWriter writer;
+    
+    writer.file = fopen([temporaryPath fileSystemRepresentation], "wb");
+    
+    if (writer.file == NULL)
+        return NO;
+    
+    writer.encoding = encoding;
+    writer.originalBytes = originalBytes;
+    writer.originalCharacters = originalCharacters;
+    writer.added = added;
+    writer.buffer = malloc(CP_WriteBufferLength * sizeof(unichar));
+    writer.count = 0;
+    writer.failed = NO;
+    
+    if (encoding == NSUnicodeStringEncoding)
+    {
+        unichar byteOrderMark = 0xFEFF;
+        
+        writer.failed = (fwrite(&byteOrderMark, sizeof(unichar), 1, writer.file) != 1);
+    }
+    
+    CPWritePieces(root, &writer);
+    CPFlushWriter(&writer, YES);
+    
+    free(writer.buffer);
+    
+    if (fclose(writer.file) != 0)
+        writer.failed = YES;
+    
+    if (writer.failed || rename([temporaryPath fileSystemRepresentation], [path fileSystemRepresentation]) != 0)
+    {
+        unlink([temporaryPath fileSystemRepresentation]);
+        return NO;
+    }
+    
+    return YES;
+}
+
+/***** Clean up *****/
+
+- (void)dealloc
+{
+    CPFreePieces(root);
+    free(added);
+    
+    [original release];
+    [emptyAttributes release];
+    [string release];
+    
+    [super dealloc];
+}
+
+@end
@@ -0,0 +1,54 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPPreferenceSnapshot.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPPreferenceSnapshot class.  See "CPPreferenceSnapshot.m" for
+ info on the CPPreferenceSnapshot class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+@interface CPPreferenceSnapshot : NSObject
+{
+    // The preferences that change how a document looks
+    
+    NSColor *backgroundColor;
+    NSColor *textColor;
+    NSFont *richTextFont;
+    NSFont *plainTextFont;
+    BOOL showRuler;
+    BOOL spellChecking;
+    BOOL showToolbar;
+    
+    // What new text looks like (see defaultTextAttributes in MyDocument)
+    
+    NSDictionary *richTextAttributes;
+    NSDictionary *plainTextAttributes;
+}
+
++ (CPPreferenceSnapshot *)snapshot;  // Read the preferences as they are right now
++ (CPPreferenceSnapshot *)currentSnapshot;  // The shared one (only read again when the preferences change)
++ (void)invalidateCurrentSnapshot;
+
+- (id)initWithUserDefaults:(NSUserDefaults *)prefs;
+
+// Accessor methods
+
+- (NSColor *)backgroundColor;
+- (NSColor *)textColor;
+- (NSFont *)richTextFont;
+- (NSFont *)plainTextFont;
+- (BOOL)showRuler;
+- (BOOL)spellChecking;
+- (BOOL)showToolbar;
+- (NSDictionary *)defaultTextAttributesForPlainText:(BOOL)plainText;
+- (BOOL)attributesArePlain:(NSDictionary *)attributes;  // Nothing that plain text would lose?
+
+@end
@@ -0,0 +1,244 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPPreferenceSnapshot.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Holds the preferences that change how a document looks, already decoded.
+ 
+ The colors are stored in the preferences as archived data, so every time
+ somebody wanted one, it had to be unarchived again -- Apply to All did it
+ twice for every open document.  A snapshot reads and unarchives all of
+ them once, and then the same snapshot can be handed to every document.
+ Snapshots never change; if the preferences do, take a new one.
+ 
+ Most of the time, you want currentSnapshot, which is shared by everybody.
+ It's thrown out when the preferences change (we get a notification for
+ that, and the Preferences window tells us when the fonts change, since
+ those don't always come with one), and read again the next time someone
+ asks for it.  The default text attributes are kept in it too, so new
+ documents, conversions, and containsFormatting don't have to unarchive
+ the text color or build a new dictionary every time.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: Added the shared snapshot and the default text attributes.
+ 
+ */
+
+#import "CPPreferenceSnapshot.h"
+#import "InterfaceController.h"
+
+static CPPreferenceSnapshot *CPCurrentSnapshot = nil;
+
+
+@implementation CPPreferenceSnapshot
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
++ (void)initialize
+{
+    if (self != [CPPreferenceSnapshot class])
+        return;
+    
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(userDefaultsDidChange:) name:NSUserDefaultsDidChangeNotification object:nil];
+}
+
++ (CPPreferenceSnapshot *)snapshot
+{
+    return [[[CPPreferenceSnapshot alloc] initWithUserDefaults:[NSUserDefaults standardUserDefaults]] autorelease];
+}
+
+/***** The shared snapshot *****/
+
++ (CPPreferenceSnapshot *)currentSnapshot
+{
+    if (CPCurrentSnapshot == nil)
+    {
+        CPCurrentSnapshot = [[CPPreferenceSnapshot alloc] initWithUserDefaults:[NSUserDefaults standardUserDefaults]];
+    }
+    
+    // Whoever asked might hang onto something from it after it's thrown out
+    
+    return [[CPCurrentSnapshot retain] autorelease];
+}
+
+/***** Throw out the shared snapshot *****/
+
++ (void)invalidateCurrentSnapshot
+{
+    [CPCurrentSnapshot release];
+    CPCurrentSnapshot = nil;
+}
+
++ (void)userDefaultsDidChange:(NSNotification *)notification
+{
+    [self invalidateCurrentSnapshot];
+}
+
+/***** The ruler for rich text *****/
+
+/*
+ * This was originally written by Apple engineer Ali Ozer for
+ * TextEdit (it used to be in defaultTextAttributes in MyDocument).
+ */
+
++ (NSParagraphStyle *)richTextParagraphStyle
+{
+    static NSParagraphStyle *defaultParagraphStyle = nil;
+    
+    if (defaultParagraphStyle == nil)
+    {
+        // We do this once...
+        
+        int i;
+        NSString *measurementUnits = [[NSUserDefaults standardUserDefaults] objectForKey:@"AppleMeasurementUnits"];
+        float tabInterval = ([@"Centimeters" isEqual:measurementUnits]) ? (72.0 / 2.54) : (72.0 / 2.0);  // Every cm or half inch
+        NSMutableParagraphStyle *paragraphStyle = [[NSMutableParagraphStyle alloc] init];
+        
+        [paragraphStyle setTabStops:[NSArray array]];  // This first clears all tab stops
+        
+        for (i = 0; i < 16; i++)
+        {
+            // Add 16 tab stops, at desired intervals...
+            
+            NSTextTab *tabStop = [[NSTextTab alloc] initWithType:NSLeftTabStopType location:tabInterval * (i + 1)];
+            [paragraphStyle addTabStop:tabStop];
+            [tabStop release];
+        }
+        
+        defaultParagraphStyle = [paragraphStyle copy];
+        [paragraphStyle release];
+    }
+    
+    return defaultParagraphStyle;
+}
+
+- (id)initWithUserDefaults:(NSUserDefaults *)prefs
+{
+    if (self = [super init])
+    {
+        backgroundColor = [[NSUnarchiver unarchiveObjectWithData:[prefs objectForKey:CP_BackgroundColor]] retain];
+        textColor = [[NSUnarchiver unarchiveObjectWithData:[prefs objectForKey:CP_TextColor]] retain];
+        richTextFont = [[NSFont userFontOfSize:0.0] retain];
+        plainTextFont = [[NSFont userFixedPitchFontOfSize:0.0] retain];
+        showRuler = [prefs boolForKey:CP_ShowRuler];
+        spellChecking = [prefs boolForKey:CP_SpellChecking];
+        showToolbar = [prefs boolForKey:CP_ShowToolbar];
+        
+        richTextAttributes = [[NSDictionary alloc] initWithObjectsAndKeys:
+            richTextFont, NSFontAttributeName,
+            textColor, NSForegroundColorAttributeName,
+            [CPPreferenceSnapshot richTextParagraphStyle], NSParagraphStyleAttributeName,
+            nil];
+        
+        plainTextAttributes = [[NSDictionary alloc] initWithObjectsAndKeys:
+            plainTextFont, NSFontAttributeName,
+            textColor, NSForegroundColorAttributeName,
+            [NSParagraphStyle defaultParagraphStyle], NSParagraphStyleAttributeName,
+            nil];
+    }
+    
+    return self;
+}
+
+/********************/
+/* Accessor methods */
+/********************/
+
+- (NSColor *)backgroundColor
+{
+    return backgroundColor;
+}
+
+- (NSColor *)textColor
+{
+    return textColor;
+}
+
+- (NSFont *)richTextFont
+{
+    return richTextFont;
+}
+
+- (NSFont *)plainTextFont
+{
+    return plainTextFont;
+}
+
+- (BOOL)showRuler
+{
+    return showRuler;
+}
+
+- (BOOL)spellChecking
+{
+    return spellChecking;
+}
+
+- (BOOL)showToolbar
+{
+    return showToolbar;
+}
+
+- (NSDictionary *)defaultTextAttributesForPlainText:(BOOL)plainText
+{
+    return (plainText) ? plainTextAttributes : richTextAttributes;
+}
+
+/***** Would plain text lose anything from these attributes? *****/
+
+/*
+ * Attributes are plain if every one of them is what a new rich text
+ * document would have anyway (anything that's missing counts as the
+ * default).  This only compares what's there -- nothing gets
+ * unarchived or built.
+ */
+
+- (BOOL)attributesArePlain:(NSDictionary *)attributes
+{
+    NSEnumerator *keyList = [attributes keyEnumerator];
+    NSString *key;
+    
+    if (attributes == richTextAttributes)
+        return YES;
+    
+    while (key = [keyList nextObject])
+    {
+        id value = [attributes objectForKey:key];
+        id defaultValue = [richTextAttributes objectForKey:key];
+        
+        if (defaultValue == nil)
+        {
+            return NO;  // Something we don't set, like a link or an attachment
+        }
+        
+        if (value != defaultValue && ![value isEqual:defaultValue])
+        {
+            // The standard paragraph style is fine too
+            
+            if (![key isEqualToString:NSParagraphStyleAttributeName] || ![value isEqual:[NSParagraphStyle defaultParagraphStyle]])
+                return NO;
+        }
+    }
+    
+    return YES;
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [backgroundColor release];
+    [textColor release];
+    [richTextFont release];
+    [plainTextFont release];
+    [richTextAttributes release];
+    [plainTextAttributes release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
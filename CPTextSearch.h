@@ -0,0 +1,61 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPTextSearch.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPTextSearch class.  See "CPTextSearch.m" for info on the
+ CPTextSearch class.
+ 
+ */
+
+#import <Cocoa/Cocoa.h>
+
+/*************/
+/* Constants */
+/*************/
+
+// Search options (these can be or'ed together)
+
+enum
+{
+    CPSearchCaseInsensitive = 1,
+    CPSearchRegularExpression = 2  // Only if supportsRegularExpressions says so
+};
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+@interface CPTextSearch : NSObject
+{
+    NSString *pattern;
+    unsigned options;
+    
+    // For plain searches
+    
+    unichar *characters;  // The pattern (folded, if we're ignoring case)
+    unsigned length;
+    unsigned shift[256];  // How far to skip, by the low byte of the last character we looked at
+    
+    id expression;  // For regular expressions (an NSRegularExpression)
+}
+
++ (BOOL)supportsRegularExpressions;  // Mac OS X 10.7 Lion and up (or GNUstep)
+
+- (id)initWithPattern:(NSString *)aPattern options:(unsigned)someOptions;  // nil if the pattern isn't valid
+
+- (NSString *)pattern;
+- (unsigned)options;
+
+// Finding (the ranges come back as an NSData full of NSRanges, in order)
+
+- (NSData *)rangesInString:(NSString *)string;  // Safe to call from any thread
+- (NSArray *)rangesInStrings:(NSArray *)strings;  // Searches them all at the same time
+
+// Replacing
+
++ (NSAttributedString *)replacementText:(NSString *)replacement forRanges:(NSData *)ranges inText:(NSAttributedString *)text lengths:(NSData **)lengths;
++ (NSAttributedString *)replaceRanges:(NSData *)ranges inText:(NSMutableAttributedString *)text withText:(NSAttributedString *)newText lengths:(NSData *)newLengths undoRanges:(NSData **)undoRanges undoLengths:(NSData **)undoLengths;
+
+@end
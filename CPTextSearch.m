@@ -0,0 +1,742 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPTextSearch.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Finds every match of a pattern in a document, and replaces them all at
+ once.  The system find panel only finds one match at a time, and does a
+ Replace All one replacement at a time, which takes forever when there are
+ a lot of matches.
+ 
+ A plain search reads the text a chunk at a time straight out of the
+ string (so it works on a CPPieceTableStorage without copying the whole
+ document), and looks for the pattern two ways:
+ 
+ - Short patterns (one to three characters) look for the first character
+   four characters at a time, using a trick that finds a zero in any of
+   the four 16-bit parts of a 64-bit number at once, and then check the
+   rest of the pattern.  That's what memchr() does for bytes.
+ - Longer patterns use Boyer-Moore-Horspool, which looks at the last
+   character under the pattern and skips ahead as far as it can.  The skip
+   table goes by the low byte of the character, so it's only 256 entries,
+   even for Unicode (it just can't skip as far when two characters share a
+   low byte).
+ 
+ Ignoring case folds the pattern and each chunk of text with a table of
+ the lowercase version of every character, one for one, so the ranges we
+ find are still the ranges in the document.  Regular expressions are done
+ by NSRegularExpression, which is only there on Mac OS X 10.7 and up (and
+ GNUstep), so supportsRegularExpressions says whether we can do them.
+ 
+ rangesInStrings: searches several documents at the same time, on a
+ CPWorkerPool of its own, and waits for all of them.  The main thread is
+ waiting, so nobody can change the text while it's being searched.
+ 
+ Replacing goes through replaceRanges:inText:withText:lengths:..., which
+ makes every replacement in one editing session, and gives back everything
+ it needs to undo it (which is the same call again).
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ 
+ */
+
+#import "CPTextSearch.h"
+#import "CPPieceTableStorage.h"
+#import "CPWorkerPool.h"
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_SearchChunkLength (256 * 1024)  // How much text we search at a time (in characters)
+#define CP_ShortPatternLength 4  // Shorter than this, and we look for the first character instead of skipping
+
+// Four 16-bit lanes in a 64-bit word (see CPFindCharacter())
+
+#define CP_LaneOnes 0x0001000100010001ULL
+#define CP_LaneHighBits 0x8000800080008000ULL
+
+/*
+ * NSRegularExpression isn't in older versions of Mac OS X, so
+ * we look for the class when we run, and declare what we use
+ * from it here (otherwise it won't build with the older SDKs).
+ */
+
+@interface NSObject (CPRegularExpressionMethods)
+
+- (id)initWithPattern:(NSString *)pattern options:(unsigned)options error:(NSError **)error;
+- (NSArray *)matchesInString:(NSString *)string options:(unsigned)options range:(NSRange)range;
+- (NSRange)range;
+
+@end
+
+/*********/
+/* Types */
+/*********/
+
+// Builds an attributed string out of a lot of little pieces
+
+typedef struct
+{
+    unichar *characters;
+    unsigned length;
+    unsigned capacity;
+    
+    // Where the attributes change
+    
+    NSDictionary **runAttributes;  // Not retained -- they belong to the text we're copying from
+    unsigned *runStarts;
+    unsigned runCount;
+    unsigned runCapacity;
+} CPTextBuilder;
+
+/********************/
+/* Static variables */
+/********************/
+
+static unichar *CPFoldTable = NULL;  // The lowercase version of every character
+static NSLock *CPFoldTableLock = nil;
+static CPWorkerPool *CPSearchPool = nil;
+
+/*************/
+/* Functions */
+/*************/
+
+/***** Make the case folding table *****/
+
+/*
+ * This only happens the first time someone ignores case.  Characters
+ * that don't have a lowercase version that's one character long (or
+ * that aren't characters by themselves, like half of a surrogate pair)
+ * stay the way they are.
+ */
+
+static void CPMakeFoldTable(void)
+{
+    [CPFoldTableLock lock];
+    
+    if (CPFoldTable == NULL)
+    {
+        unichar *table = malloc(65536 * sizeof(unichar));
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        unsigned character;
+        
+        for (character = 0; character < 65536; character++)
+        {
+            table[character] = character;
+            
+            if (character >= 'A' && character <= 'Z')
+            {
+                table[character] = character + ('a' - 'A');
+            }
+            
+            else if (character >= 0x80 && (character < 0xD800 || character > 0xDFFF))
+            {
+                unichar original = character;
+                NSString *lowercase = [[NSString stringWithCharacters:&original length:1] lowercaseString];
+                
+                if ([lowercase length] == 1)
+                    table[character] = [lowercase characterAtIndex:0];
+            }
+            
+            if ((character & 0xFFF) == 0xFFF)
+            {
+                [pool release];
+                pool = [[NSAutoreleasePool alloc] init];
+            }
+        }
+        
+        [pool release];
+        
+        CPFoldTable = table;
+    }
+    
+    [CPFoldTableLock unlock];
+}
+
+static void CPFoldCharacters(unichar *characters, unsigned length)
+{
+    unsigned i;
+    
+    for (i = 0; i < length; i++)
+        characters[i] = CPFoldTable[characters[i]];
+}
+
+/***** Find a character, four at a time *****/
+
+/*
+ * XORing with the character we want turns it into zero, and
+ * (x - 1) & ~x has the high bit set only where x was zero,
+ * so we can check four characters with a few instructions.
+ * Looks at [from, end) and returns NSNotFound if it isn't there.
+ */
+
+static unsigned CPFindCharacter(const unichar *text, unsigned from, unsigned end, unichar character)
+{
+    const unichar *current = text + from;
+    const unichar *stop = text + end;
+    unsigned long long lanes = character * CP_LaneOnes;
+    
+    // Get lined up on an 8 byte boundary first
+    
+    while (current < stop && ((unsigned long)current & 7) != 0)
+    {
+        if (*current == character)
+            return current - text;
+        
+        current++;
+    }
+    
+    while (current + 4 <= stop)
+    {
+        unsigned long long word = *(const unsigned long long *)current ^ lanes;
+        
+        if (((word - CP_LaneOnes) & ~word & CP_LaneHighBits) != 0)
+            break;  // It's one of these four
+        
+        current += 4;
+    }
+    
+    while (current < stop)
+    {
+        if (*current == character)
+            return current - text;
+        
+        current++;
+    }
+    
+    return NSNotFound;
+}
+
+/***** Find the pattern *****/
+
+/*
+ * Returns the first match that starts at from or later and fits
+ * before end, or NSNotFound.
+ */
+
+static unsigned CPFindPattern(const unichar *text, unsigned from, unsigned end, const unichar *pattern, unsigned length, const unsigned *shift)
+{
+    if (length < CP_ShortPatternLength)
+    {
+        while (from + length <= end)
+        {
+            unsigned found = CPFindCharacter(text, from, end - length + 1, pattern[0]);
+            
+            if (found == NSNotFound)
+                return NSNotFound;
+            
+            if (memcmp(text + found + 1, pattern + 1, (length - 1) * sizeof(unichar)) == 0)
+                return found;
+            
+            from = found + 1;
+        }
+    }
+    
+    else
+    {
+        unichar last = pattern[length - 1];
+        
+        while (from + length <= end)
+        {
+            unichar character = text[from + length - 1];
+            
+            if (character == last && memcmp(text + from, pattern, (length - 1) * sizeof(unichar)) == 0)
+                return from;
+            
+            from += shift[character & 0xFF];
+        }
+    }
+    
+    return NSNotFound;
+}
+
+/***** Build an attributed string a piece at a time *****/
+
+static void CPAddRun(CPTextBuilder *builder, unsigned start, NSDictionary *attributes)
+{
+    if (builder->runCount > 0)
+    {
+        NSDictionary *last = builder->runAttributes[builder->runCount - 1];
+        
+        if (last == attributes || [last isEqualToDictionary:attributes])
+            return;  // Same as the run before it
+    }
+    
+    if (builder->runCount == builder->runCapacity)
+    {
+        builder->runCapacity = MAX(builder->runCapacity * 2, 16U);
+        builder->runAttributes = realloc(builder->runAttributes, builder->runCapacity * sizeof(NSDictionary *));
+        builder->runStarts = realloc(builder->runStarts, builder->runCapacity * sizeof(unsigned));
+    }
+    
+    builder->runAttributes[builder->runCount] = attributes;
+    builder->runStarts[builder->runCount] = start;
+    builder->runCount++;
+}
+
+static unichar *CPMakeRoom(CPTextBuilder *builder, unsigned length)
+{
+    if (builder->length + length > builder->capacity)
+    {
+        builder->capacity = MAX(MAX(builder->capacity * 2, builder->length + length), 1024U);
+        builder->characters = realloc(builder->characters, builder->capacity * sizeof(unichar));
+    }
+    
+    return builder->characters + builder->length;
+}
+
+static void CPAppendText(CPTextBuilder *builder, NSAttributedString *text, NSRange range)
+{
+    unsigned location = range.location;
+    
+    if (range.length == 0)
+        return;
+    
+    [[text string] getCharacters:CPMakeRoom(builder, range.length) range:range];
+    
+    while (location < NSMaxRange(range))
+    {
+        NSRange run;
+        NSDictionary *attributes = [text attributesAtIndex:location effectiveRange:&run];
+        
+        CPAddRun(builder, builder->length + (location - range.location), attributes);
+        location = NSMaxRange(run);
+    }
+    
+    builder->length += range.length;
+}
+
+static void CPAppendCharacters(CPTextBuilder *builder, const unichar *characters, unsigned length, NSDictionary *attributes)
+{
+    if (length == 0)
+        return;
+    
+    memcpy(CPMakeRoom(builder, length), characters, length * sizeof(unichar));
+    CPAddRun(builder, builder->length, attributes);
+    
+    builder->length += length;
+}
+
+/*
+ * Everything starts out with the first run's attributes, so we
+ * only have to set the runs that are different (usually none).
+ */
+
+static NSAttributedString *CPFinishText(CPTextBuilder *builder)
+{
+    NSString *string;
+    NSMutableAttributedString *text;
+    unsigned i;
+    
+    if (builder->length == 0)
+    {
+        free(builder->characters);
+        string = [[NSString alloc] init];
+    }
+    
+    else
+    {
+        string = [[NSString alloc] initWithCharactersNoCopy:builder->characters length:builder->length freeWhenDone:YES];
+    }
+    
+    text = [[NSMutableAttributedString alloc] initWithString:string attributes:(builder->runCount > 0) ? builder->runAttributes[0] : nil];
+    
+    [text beginEditing];
+    
+    for (i = 1; i < builder->runCount; i++)
+    {
+        NSDictionary *attributes = builder->runAttributes[i];
+        
+        if (attributes != builder->runAttributes[0] && ![attributes isEqualToDictionary:builder->runAttributes[0]])
+        {
+            unsigned end = (i + 1 < builder->runCount) ? builder->runStarts[i + 1] : builder->length;
+            
+            [text setAttributes:attributes range:NSMakeRange(builder->runStarts[i], end - builder->runStarts[i])];
+        }
+    }
+    
+    [text endEditing];
+    
+    free(builder->runAttributes);
+    free(builder->runStarts);
+    [string release];
+    
+    return [text autorelease];
+}
+
+
+@implementation CPTextSearch
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
++ (void)initialize
+{
+    if (self != [CPTextSearch class])
+        return;
+    
+    CPFoldTableLock = [[NSLock alloc] init];
+}
+
++ (BOOL)supportsRegularExpressions
+{
+    return (NSClassFromString(@"NSRegularExpression") != nil);
+}
+
+/***** Our own threads, so waiting for them doesn't wait for anything else *****/
+
++ (CPWorkerPool *)searchPool
+{
+    if (CPSearchPool == nil)
+    {
+        CPSearchPool = [[CPWorkerPool alloc] initWithThreadCount:[CPWorkerPool processorCount]];
+    }
+    
+    return CPSearchPool;
+}
+
+- (id)initWithPattern:(NSString *)aPattern options:(unsigned)someOptions
+{
+    if (self = [super init])
+    {
+        pattern = [aPattern copy];
+        options = someOptions;
+        
+        if (options & CPSearchRegularExpression)
+        {
+            Class expressionClass = NSClassFromString(@"NSRegularExpression");
+            
+            // 1 is NSRegularExpressionCaseInsensitive
+            
+            expression = [[expressionClass alloc] initWithPattern:pattern options:(options & CPSearchCaseInsensitive) ? 1 : 0 error:NULL];
+            
+            if (expression == nil)
+            {
+                [self release];
+                return nil;
+            }
+        }
+        
+        else
+        {
+            unsigned i;
+            
+            length = [pattern length];
+            characters = malloc(MAX(length, 1U) * sizeof(unichar));
+            [pattern getCharacters:characters];
+            
+            if (options & CPSearchCaseInsensitive)
+            {
+                CPMakeFoldTable();
+                CPFoldCharacters(characters, length);
+            }
+            
+            // How far we can skip when we see each character under the end of the pattern
+            
+            for (i = 0; i < 256; i++)
+                shift[i] = MAX(length, 1U);
+            
+            for (i = 0; i + 1 < length; i++)
+                shift[characters[i] & 0xFF] = length - 1 - i;
+        }
+    }
+    
+    return self;
+}
+
+/********************/
+/* Accessor methods */
+/********************/
+
+- (NSString *)pattern
+{
+    return pattern;
+}
+
+- (unsigned)options
+{
+    return options;
+}
+
+/***********/
+/* Finding */
+/***********/
+
+/***** Find every match in a string *****/
+
+/*
+ * Matches don't overlap -- the next one starts after the end of the
+ * last one.  The chunks overlap by one character less than the
+ * pattern, so a match can't fall in between two of them.
+ */
+
+- (NSData *)rangesInString:(NSString *)string
+{
+    NSMutableData *ranges = [NSMutableData data];
+    unsigned total = [string length];
+    unsigned next = 0;  // No match can start before this
+    unsigned start;
+    unichar *buffer;
+    
+    if (expression != nil)
+    {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSEnumerator *matches = [[expression matchesInString:string options:0 range:NSMakeRange(0, total)] objectEnumerator];
+        id match;
+        
+        while (match = [matches nextObject])
+        {
+            NSRange range = [match range];
+            [ranges appendBytes:&range length:sizeof(NSRange)];
+        }
+        
+        [pool release];
+        
+        return ranges;
+    }
+    
+    if (length == 0 || total < length)
+        return ranges;
+    
+    buffer = malloc((CP_SearchChunkLength + length - 1) * sizeof(unichar));
+    
+    for (start = 0; start + length <= total; start += CP_SearchChunkLength)
+    {
+        unsigned count = MIN(CP_SearchChunkLength + length - 1, total - start);
+        unsigned limit = MIN((unsigned)CP_SearchChunkLength, count - length + 1);  // Matches have to start before this
+        unsigned from = (next > start) ? next - start : 0;
+        
+        [string getCharacters:buffer range:NSMakeRange(start, count)];
+        
+        if (options & CPSearchCaseInsensitive)
+            CPFoldCharacters(buffer, count);
+        
+        while (from < limit)
+        {
+            unsigned found = CPFindPattern(buffer, from, limit + length - 1, characters, length, shift);
+            NSRange range;
+            
+            if (found == NSNotFound)
+                break;
+            
+            range = NSMakeRange(start + found, length);
+            [ranges appendBytes:&range length:sizeof(NSRange)];
+            
+            from = found + length;
+        }
+        
+        next = start + from;
+    }
+    
+    free(buffer);
+    
+    return ranges;
+}
+
+/***** Search a few strings at the same time *****/
+
+/*
+ * Gives back an array with the ranges for each string.  Don't
+ * change any of the strings until it's done (it waits for all
+ * of them, so if it's called on the main thread, nothing can).
+ */
+
+- (NSArray *)rangesInStrings:(NSArray *)strings
+{
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:[strings count]];
+    NSMutableArray *tasks = [NSMutableArray arrayWithCapacity:[strings count]];
+    CPWorkerPool *pool = [CPTextSearch searchPool];
+    NSEnumerator *list;
+    NSString *string;
+    CPWorkerTask *task;
+    
+    // No sense in using threads for one
+    
+    if ([strings count] == 1)
+    {
+        return [NSArray arrayWithObject:[self rangesInString:[strings objectAtIndex:0]]];
+    }
+    
+    list = [strings objectEnumerator];
+    
+    while (string = [list nextObject])
+    {
+        [tasks addObject:[pool addTaskWithTarget:self selector:@selector(rangesInString:) object:string]];
+    }
+    
+    [pool waitUntilIdle];
+    
+    list = [tasks objectEnumerator];
+    
+    while (task = [list nextObject])
+    {
+        [results addObject:([task result] != nil) ? [task result] : [NSData data]];
+    }
+    
+    return results;
+}
+
+/*************/
+/* Replacing */
+/*************/
+
+/***** Make the text that goes in place of every match *****/
+
+/*
+ * Each replacement gets the attributes of the text it's replacing
+ * (the way typing over a selection does).  lengths is set to how
+ * long each one is, for replaceRanges:....
+ */
+
++ (NSAttributedString *)replacementText:(NSString *)replacement forRanges:(NSData *)ranges inText:(NSAttributedString *)text lengths:(NSData **)lengths
+{
+    const NSRange *list = [ranges bytes];
+    unsigned count = [ranges length] / sizeof(NSRange);
+    unsigned replacementLength = [replacement length];
+    unsigned textLength = [text length];
+    NSMutableData *lengthData = [NSMutableData dataWithLength:count * sizeof(unsigned)];
+    unsigned *lengthList = [lengthData mutableBytes];
+    unichar *replacementCharacters = malloc(MAX(replacementLength, 1U) * sizeof(unichar));
+    NSDictionary *noAttributes = [NSDictionary dictionary];
+    CPTextBuilder builder = {0};
+    unsigned i;
+    
+    [replacement getCharacters:replacementCharacters];
+    
+    for (i = 0; i < count; i++)
+    {
+        unsigned location = list[i].location;
+        NSDictionary *attributes = noAttributes;
+        
+        if (textLength > 0)
+            attributes = [text attributesAtIndex:(location < textLength) ? location : textLength - 1 effectiveRange:NULL];
+        
+        CPAppendCharacters(&builder, replacementCharacters, replacementLength, attributes);
+        lengthList[i] = replacementLength;
+    }
+    
+    free(replacementCharacters);
+    
+    *lengths = lengthData;
+    
+    return CPFinishText(&builder);
+}
+
+/***** Replace a lot of ranges at once *****/
+
+/*
+ * ranges have to be in order, and can't overlap.  Range number i is
+ * replaced by the next newLengths[i] characters of newText.  It all
+ * happens in one editing session, so the text system only hears about
+ * it once.
+ *
+ * Gives back the text that was replaced, and sets undoRanges and
+ * undoLengths, so calling this again with those puts everything back.
+ *
+ * A CPPieceTableStorage can change each range by itself in no time.
+ * Anything else would have to move the rest of the text for every
+ * match, so we build everything from the first match to the last
+ * and put that in instead, all at once.
+ */
+
++ (NSAttributedString *)replaceRanges:(NSData *)ranges inText:(NSMutableAttributedString *)text withText:(NSAttributedString *)newText lengths:(NSData *)newLengths undoRanges:(NSData **)undoRanges undoLengths:(NSData **)undoLengths
+{
+    const NSRange *list = [ranges bytes];
+    const unsigned *newLengthList = [newLengths bytes];
+    unsigned count = [ranges length] / sizeof(NSRange);
+    NSMutableData *undoRangeData = [NSMutableData dataWithLength:count * sizeof(NSRange)];
+    NSMutableData *undoLengthData = [NSMutableData dataWithLength:count * sizeof(unsigned)];
+    NSRange *undoRangeList = [undoRangeData mutableBytes];
+    unsigned *undoLengthList = [undoLengthData mutableBytes];
+    BOOL pieceTable = [text isKindOfClass:[CPPieceTableStorage class]];
+    CPTextBuilder originals = {0};
+    CPTextBuilder span = {0};
+    NSRange spanRange;
+    NSAttributedString *originalText;
+    unsigned location, offset = 0, i;
+    int change = 0;
+    
+    *undoRanges = undoRangeData;
+    *undoLengths = undoLengthData;
+    
+    if (count == 0)
+        return [[[NSAttributedString alloc] init] autorelease];
+    
+    spanRange = NSMakeRange(list[0].location, NSMaxRange(list[count - 1]) - list[0].location);
+    location = spanRange.location;
+    
+    // Save what we're replacing (and where it will be), and build the new text
+    
+    for (i = 0; i < count; i++)
+    {
+        NSRange range = list[i];
+        
+        CPAppendText(&originals, text, range);
+        undoRangeList[i] = NSMakeRange((unsigned)((int)range.location + change), newLengthList[i]);
+        undoLengthList[i] = range.length;
+        
+        if (!pieceTable)
+        {
+            CPAppendText(&span, text, NSMakeRange(location, range.location - location));
+            CPAppendText(&span, newText, NSMakeRange(offset, newLengthList[i]));
+        }
+        
+        location = NSMaxRange(range);
+        offset += newLengthList[i];
+        change += (int)newLengthList[i] - (int)range.length;
+    }
+    
+    originalText = CPFinishText(&originals);
+    
+    // Now put it in
+    
+    [text beginEditing];
+    
+    if (pieceTable)
+    {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        
+        // From the end, so the ranges we haven't done yet don't move
+        
+        for (i = count; i > 0; i--)
+        {
+            offset -= newLengthList[i - 1];
+            [text replaceCharactersInRange:list[i - 1] withAttributedString:[newText attributedSubstringFromRange:NSMakeRange(offset, newLengthList[i - 1])]];
+            
+            if ((i & 0x3FF) == 0)
+            {
+                [pool release];
+                pool = [[NSAutoreleasePool alloc] init];
+            }
+        }
+        
+        [pool release];
+    }
+    
+    else
+    {
+        [text replaceCharactersInRange:spanRange withAttributedString:CPFinishText(&span)];
+    }
+    
+    [text endEditing];
+    
+    return originalText;
+}
+
+/***** Clean up *****/
+
+- (void)dealloc
+{
+    free(characters);
+    
+    [pattern release];
+    [expression release];
+    
+    [super dealloc];
+}
+
+@end
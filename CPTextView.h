@@ -13,6 +13,24 @@
 
 @interface CPTextView : NSTextView
 {
+    // The preferences, so we don't look them up on every keystroke
+    
+    BOOL smartQuotes;
+    BOOL logTyping;
+    
+    // The quotes we insert (they're localized)
+    
+    NSString *openingQuote;
+    NSString *closingQuote;
+    NSString *openingSingleQuote;
+    NSString *closingSingleQuote;
+    
+    // Typing speed (only kept track of if LogPerformance is on)
+    
+    NSTimeInterval typingTime;
+    unsigned typingCount;
 }
 
-@end
\ No newline at end of file
+- (void)userDefaultsDidChange:(NSNotification *)notification;
+
+@end
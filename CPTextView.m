@@ -9,6 +9,9 @@
  
  - 06/07/05: FINALLY COMPLETED COCOAPAD 1.0!!!
  - 10/14/07: Released CocoaPad v1.1, with 2 bug fixes!
+ - 10/17/26: Smart quotes are put in by insertText: now, instead of being
+             swapped in after keyDown:, so they're one edit (and one undo).
+             The preference is only read when it changes.
  
  */
 
@@ -16,83 +19,142 @@
 #import "InterfaceController.h"
 #import "LocalizedStrings.h"
 
+/*************/
+/* Constants */
+/*************/
+
+#define CP_TypingSampleCount 1000  // How many keystrokes we average when logging typing speed
+
+/***** Does a quote after this character open a quotation? *****/
+
+static BOOL CPOpensQuotation(unichar character)
+{
+    switch (character)
+    {
+        case ' ':
+        case '\t':
+        case '\n':
+        case '\r':
+        case '(':
+        case '[':
+        case '{':
+        case '<':
+        case 0x00A0:  // Non-breaking space
+        case 0x2014:  // Em dash
+        case 0x2018:  // Opening single quote (for a quote inside a quote)
+        case 0x201C:  // Opening quote
+        case 0x2028:  // Line separator
+        case 0x2029:  // Paragraph separator
+            return YES;
+        
+        default:
+            return NO;
+    }
+}
+
 
 @implementation CPTextView
 
-/***** Intercept strait quotes and replace with smart quotes *****/
+/**************************/
+/* Initialization methods */
+/**************************/
 
-- (void)keyDown:(NSEvent *)event
+- (void)awakeFromNib
 {
-    NSString *input = [event characters];
+    // NSTextView only has its own awakeFromNib on some versions of Mac OS X
     
-    [super keyDown:event];  // Don't want to eat the key events
+    if ([NSTextView instancesRespondToSelector:@selector(awakeFromNib)])
+        [super awakeFromNib];
     
-    // If smart quotes is enabled...
+    [self userDefaultsDidChange:nil];  // Read the preferences
     
-    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_EnableSmartQuotes])
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(userDefaultsDidChange:) name:NSUserDefaultsDidChangeNotification object:nil];
+}
+
+/***** The preferences changed (or we're just starting up) *****/
+
+- (void)userDefaultsDidChange:(NSNotification *)notification
+{
+    NSUserDefaults *prefs = [NSUserDefaults standardUserDefaults];
+    
+    smartQuotes = [prefs boolForKey:CP_EnableSmartQuotes];
+    logTyping = [prefs boolForKey:CP_LogPerformance];
+    
+    if (openingQuote == nil)
     {
-        if ([input isEqualToString:@"\""])
+        openingQuote = [L_OPENING_QUOTE retain];
+        closingQuote = [L_CLOSING_QUOTE retain];
+        openingSingleQuote = [L_OPENING_SINGLE_QUOTE retain];
+        closingSingleQuote = [L_CLOSING_SINGLE_QUOTE retain];
+    }
+}
+
+/***************/
+/* Typing text */
+/***************/
+
+/***** Replace straight quotes with smart quotes *****/
+
+/*
+ * This used to be done in keyDown:, after the straight quote was
+ * already typed, so every quote was two edits (and two undos).  It
+ * also read the preference and copied the previous character into a
+ * new string on every keystroke.  Now the quote is swapped before
+ * it's inserted, and we only look at the one character before it.
+ * At the beginning of the document there isn't one, so it's always
+ * an opening quote.  If there's marked text (an input method is
+ * busy), we leave the quote alone.
+ */
+
+- (void)insertText:(id)aString
+{
+    NSDate *start = (logTyping) ? [NSDate date] : nil;
+    
+    if (smartQuotes && [aString isKindOfClass:[NSString class]] && [aString length] == 1 && ![self hasMarkedText])
+    {
+        unichar character = [aString characterAtIndex:0];
+        
+        if (character == '"' || character == '\'')
         {
-            int previousCharLocation = [self selectedRange].location - 1;
-            
-            // Insert a "" -- we're at the beginning of the document
+            unsigned location = [self selectedRange].location;
+            BOOL opening = (location == 0 || CPOpensQuotation([[[self textStorage] string] characterAtIndex:location - 1]));
             
-            if (previousCharLocation <= 0)
-            {            
-                [self replaceCharactersInRange:NSMakeRange(0, 1) withString:L_OPENING_QUOTE];
-            }
+            if (character == '"')
+                aString = (opening) ? openingQuote : closingQuote;
             
             else
-            {
-                NSString *previousChar = [[self string] substringWithRange:NSMakeRange(previousCharLocation - 1, 1)];
-                
-                // If the previous character is a space, tab, return, or opening parentheses, insert a ""
-                
-                if ([previousChar isEqualToString:@" "] || [previousChar isEqualToString:@"\t"] || [previousChar isEqualToString:@"\n"] || [previousChar isEqualToString:@"("])
-                {
-                    [self replaceCharactersInRange:NSMakeRange(previousCharLocation, 1) withString:L_OPENING_QUOTE];
-                }
-                
-                // Otherwise, insert a ""
-                
-                else
-                {
-                    [self replaceCharactersInRange:NSMakeRange(previousCharLocation, 1) withString:L_CLOSING_QUOTE];
-                }
-            }
+                aString = (opening) ? openingSingleQuote : closingSingleQuote;
         }
+    }
+    
+    [super insertText:aString];
+    
+    if (logTyping)
+    {
+        typingTime -= [start timeIntervalSinceNow];
         
-        if ([input isEqualToString:@"'"])
+        if (++typingCount == CP_TypingSampleCount)
         {
-            int previousCharLocation = [self selectedRange].location - 1;
-            
-            // Insert a "" -- we're at the beginning of the document
-            
-            if (previousCharLocation <= 0)
-            {            
-                [self replaceCharactersInRange:NSMakeRange(0, 1) withString:L_OPENING_SINGLE_QUOTE];
-            }
+            NSLog(@"Typing: %.1f microseconds per keystroke (average of %u)", (typingTime / typingCount) * 1000000.0, typingCount);
             
-            else
-            {
-                NSString *previousChar = [[self string] substringWithRange:NSMakeRange(previousCharLocation - 1, 1)];
-                
-                // If the previous character is a space, tab, return, or opening parentheses, insert a ""
-                
-                if ([previousChar isEqualToString:@" "] || [previousChar isEqualToString:@"\t"] || [previousChar isEqualToString:@"\n"] || [previousChar isEqualToString:@"("])
-                {
-                    [self replaceCharactersInRange:NSMakeRange(previousCharLocation, 1) withString:L_OPENING_SINGLE_QUOTE];
-                }
-                
-                // Otherwise, insert a ""
-                
-                else
-                {
-                    [self replaceCharactersInRange:NSMakeRange(previousCharLocation, 1) withString:L_CLOSING_SINGLE_QUOTE];
-                }
-            }
+            typingTime = 0.0;
+            typingCount = 0;
         }
     }
 }
 
-@end
\ No newline at end of file
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    
+    [openingQuote release];
+    [closingQuote release];
+    [openingSingleQuote release];
+    [closingSingleQuote release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
@@ -0,0 +1,85 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPWorkerPool.h
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ This is the header file that initializes all the variables, functions, and
+ stuff for the CPWorkerPool and CPWorkerTask classes.  See "CPWorkerPool.m"
+ for info on the CPWorkerPool class.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+// One piece of work for the pool
+
+@interface CPWorkerTask : NSObject
+{
+    id target;  // Does the work (retained until the task is done)
+    SEL selector;  // - (id)doWork:(id)object -- runs on a worker thread
+    id object;  // Passed to the selector
+    id result;  // Whatever the selector returned
+    
+    id delegate;  // Told when the task is done, on the main thread (not retained -- cancel the task before the delegate goes away)
+    SEL didFinishSelector;  // - (void)taskDidFinish:(CPWorkerTask *)task
+    
+    NSConditionLock *lock;  // Protects the flags (the condition says whether it's finished)
+    BOOL cancelled;
+    BOOL finished;
+    NSTimeInterval runTime;  // How long the work took
+}
+
+- (id)initWithTarget:(id)aTarget selector:(SEL)aSelector object:(id)anObject delegate:(id)aDelegate didFinishSelector:(SEL)aDidFinishSelector;
+
+- (id)target;
+- (id)object;
+- (id)result;  // Only valid once the task is finished
+- (NSTimeInterval)runTime;
+
+- (void)cancel;  // If it hasn't started, it won't; either way, the delegate won't hear about it
+- (BOOL)isCancelled;
+- (BOOL)isFinished;
+- (void)waitUntilFinished;  // Block until the work is done (or skipped, if it was cancelled first)
+
+- (void)run;  // Called by the pool
+
+@end
+
+// A fixed number of threads that run tasks in the background
+
+@interface CPWorkerPool : NSObject
+{
+    NSConditionLock *queueLock;  // The condition says whether there are tasks waiting or running
+    NSMutableArray *queue;  // Tasks that haven't started yet
+    unsigned threadCount;
+    
+    // Progress (protected by queueLock)
+    
+    unsigned runningCount;
+    unsigned finishedCount;
+}
+
++ (CPWorkerPool *)sharedPool;  // One thread per processor
++ (unsigned)processorCount;
+
+- (id)initWithThreadCount:(unsigned)count;
+
+// Adding and cancelling tasks
+
+- (CPWorkerTask *)addTaskWithTarget:(id)target selector:(SEL)selector object:(id)object;
+- (CPWorkerTask *)addTaskWithTarget:(id)target selector:(SEL)selector object:(id)object delegate:(id)delegate didFinishSelector:(SEL)didFinishSelector;
+- (void)cancelTasksForTarget:(id)target;
+- (BOOL)removeTask:(CPWorkerTask *)task;  // NO if it's already started
+- (void)waitUntilIdle;  // Block until every task is done
+
+// Progress
+
+- (unsigned)threadCount;
+- (unsigned)pendingCount;  // Waiting or running
+- (unsigned)finishedCount;  // Since the pool was created
+
+@end
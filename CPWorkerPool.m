@@ -0,0 +1,435 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- CPWorkerPool.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ Runs slow work (like encoding a big document) on a few background threads,
+ so the interface doesn't lock up.
+ 
+ There's one thread per processor, and they live as long as the pool does
+ (the shared pool lives as long as CocoaPad does).  Tasks are run in the
+ order they're added, and when several documents are being encoded at the
+ same time, each one gets its own thread, so they're spread across all of
+ the processors.  The work itself has to stay away from the interface --
+ it should only look at the object it's given (like a snapshot of the
+ text).  When it's done, the delegate is told on the main thread, which is
+ where the result should be used.
+ 
+ A task can be cancelled at any time.  If it hasn't started yet, it never
+ will, and either way the delegate doesn't hear about it.  Documents cancel
+ their tasks when they're closed.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: Added waitUntilFinished, so a document being saved can wait
+             for the encoding that's already running instead of starting
+             it all over again.
+ - 10/17/26: Tasks don't keep their delegates anymore (so a document is
+             never let go of on a worker thread), a task that hasn't
+             started can be taken back off the queue, and waitUntilIdle
+             waits on the queue lock instead of checking every so often.
+ 
+ */
+
+#import "CPWorkerPool.h"
+
+// For sysconf()
+#import <unistd.h>
+
+/*************/
+/* Constants */
+/*************/
+
+// Conditions for the queue lock
+
+enum
+{
+    CPPoolIdle = 0,  // Nothing waiting or running
+    CPNoTasksWaiting,  // Nothing waiting, but something's still running
+    CPTasksWaiting
+};
+
+// Conditions for each task's lock
+
+enum
+{
+    CPTaskNotFinished = 0,
+    CPTaskFinished
+};
+
+
+@implementation CPWorkerTask
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+- (id)initWithTarget:(id)aTarget selector:(SEL)aSelector object:(id)anObject delegate:(id)aDelegate didFinishSelector:(SEL)aDidFinishSelector
+{
+    if (self = [super init])
+    {
+        target = [aTarget retain];
+        selector = aSelector;
+        object = [anObject retain];
+        delegate = aDelegate;  // Not retained (see the header)
+        didFinishSelector = aDidFinishSelector;
+        lock = [[NSConditionLock alloc] initWithCondition:CPTaskNotFinished];
+    }
+    
+    return self;
+}
+
+/********************/
+/* Accessor methods */
+/********************/
+
+- (id)target
+{
+    return target;
+}
+
+- (id)object
+{
+    return object;
+}
+
+- (id)result
+{
+    id value;
+    
+    [lock lock];
+    value = result;
+    [lock unlock];
+    
+    return value;
+}
+
+- (NSTimeInterval)runTime
+{
+    NSTimeInterval value;
+    
+    [lock lock];
+    value = runTime;
+    [lock unlock];
+    
+    return value;
+}
+
+- (void)cancel
+{
+    [lock lock];
+    cancelled = YES;
+    [lock unlock];
+}
+
+- (BOOL)isCancelled
+{
+    BOOL value;
+    
+    [lock lock];
+    value = cancelled;
+    [lock unlock];
+    
+    return value;
+}
+
+- (BOOL)isFinished
+{
+    BOOL value;
+    
+    [lock lock];
+    value = finished;
+    [lock unlock];
+    
+    return value;
+}
+
+/***** Wait for the work to be done *****/
+
+- (void)waitUntilFinished
+{
+    [lock lockWhenCondition:CPTaskFinished];
+    [lock unlock];
+}
+
+/*******************/
+/* Running methods */
+/*******************/
+
+/***** Do the work (on a worker thread) *****/
+
+- (void)run
+{
+    NSDate *start = [NSDate date];
+    id value = nil;
+    
+    if (![self isCancelled])
+    {
+        NS_DURING
+            value = [target performSelector:selector withObject:object];
+        NS_HANDLER
+            NSLog(@"Something fishy happened in a background task: %@", localException);
+        NS_ENDHANDLER
+    }
+    
+    [lock lock];
+    result = [value retain];
+    runTime = -[start timeIntervalSinceNow];
+    finished = YES;
+    [lock unlockWithCondition:CPTaskFinished];
+    
+    if (delegate != nil && ![self isCancelled])
+    {
+        [self performSelectorOnMainThread:@selector(notifyDelegate) withObject:nil waitUntilDone:NO];
+    }
+}
+
+/***** Tell the delegate we're done (on the main thread) *****/
+
+- (void)notifyDelegate
+{
+    // It might have been cancelled while we were waiting for the main thread
+    
+    if (![self isCancelled])
+    {
+        [delegate performSelector:didFinishSelector withObject:self];
+    }
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [target release];
+    [object release];
+    [result release];
+    [lock release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
+
+
+@implementation CPWorkerPool
+
+/**************************/
+/* Initialization methods */
+/**************************/
+
+/***** The pool everybody shares *****/
+
++ (CPWorkerPool *)sharedPool
+{
+    static CPWorkerPool *sharedPool = nil;
+    
+    if (sharedPool == nil)
+    {
+        sharedPool = [[CPWorkerPool alloc] initWithThreadCount:[self processorCount]];
+    }
+    
+    return sharedPool;
+}
+
+/***** How many processors do we have? *****/
+
++ (unsigned)processorCount
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    
+    return (count > 0) ? (unsigned)count : 1;
+}
+
+- (id)initWithThreadCount:(unsigned)count
+{
+    if (self = [super init])
+    {
+        unsigned i;
+        
+        queueLock = [[NSConditionLock alloc] initWithCondition:CPPoolIdle];
+        queue = [[NSMutableArray alloc] init];
+        threadCount = (count > 0) ? count : 1;
+        
+        for (i = 0; i < threadCount; i++)
+        {
+            [NSThread detachNewThreadSelector:@selector(workerThread:) toTarget:self withObject:nil];
+        }
+    }
+    
+    return self;
+}
+
+/***** What the queue lock's condition should be (call with it locked) *****/
+
+- (int)queueCondition
+{
+    if ([queue count] > 0)
+        return CPTasksWaiting;
+    
+    return (runningCount > 0) ? CPNoTasksWaiting : CPPoolIdle;
+}
+
+/****************/
+/* Task methods */
+/****************/
+
+/***** Add a task nobody needs to hear back about *****/
+
+- (CPWorkerTask *)addTaskWithTarget:(id)target selector:(SEL)selector object:(id)object
+{
+    return [self addTaskWithTarget:target selector:selector object:object delegate:nil didFinishSelector:NULL];
+}
+
+/***** Add a task *****/
+
+- (CPWorkerTask *)addTaskWithTarget:(id)target selector:(SEL)selector object:(id)object delegate:(id)delegate didFinishSelector:(SEL)didFinishSelector
+{
+    CPWorkerTask *task = [[[CPWorkerTask alloc] initWithTarget:target selector:selector object:object delegate:delegate didFinishSelector:didFinishSelector] autorelease];
+    
+    [queueLock lock];
+    [queue addObject:task];
+    [queueLock unlockWithCondition:CPTasksWaiting];
+    
+    return task;
+}
+
+/***** Cancel everything for a target (like a document that's closing) *****/
+
+- (void)cancelTasksForTarget:(id)target
+{
+    int i;
+    
+    [queueLock lock];
+    
+    for (i = [queue count] - 1; i >= 0; i--)
+    {
+        CPWorkerTask *task = [queue objectAtIndex:i];
+        
+        if ([task target] == target)
+        {
+            [task cancel];
+            [task run];  // It's cancelled, so this just marks it finished (for anyone waiting on it)
+            [queue removeObjectAtIndex:i];
+        }
+    }
+    
+    [queueLock unlockWithCondition:[self queueCondition]];
+    
+    // Running tasks can't be stopped, but their delegates won't be told.
+    // The target has to keep track of its own running tasks and cancel them.
+}
+
+/***** Take back a task that hasn't started yet *****/
+
+/*
+ * Returns YES if the task was still waiting, so it never will run (it's
+ * cancelled and marked finished).  If it's already running or done, it's
+ * left alone and we return NO.
+ */
+
+- (BOOL)removeTask:(CPWorkerTask *)task
+{
+    unsigned index;
+    
+    [queueLock lock];
+    
+    index = [queue indexOfObjectIdenticalTo:task];
+    
+    if (index != NSNotFound)
+    {
+        [task cancel];
+        [task run];  // It's cancelled, so this just marks it finished
+        [queue removeObjectAtIndex:index];
+    }
+    
+    [queueLock unlockWithCondition:[self queueCondition]];
+    
+    return (index != NSNotFound);
+}
+
+/***** Wait for everything to finish *****/
+
+- (void)waitUntilIdle
+{
+    [queueLock lockWhenCondition:CPPoolIdle];
+    [queueLock unlock];
+}
+
+/***** The worker threads *****/
+
+- (void)workerThread:(id)unused
+{
+    while (YES)
+    {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        CPWorkerTask *task;
+        
+        // Wait for something to do
+        
+        [queueLock lockWhenCondition:CPTasksWaiting];
+        
+        task = [[queue objectAtIndex:0] retain];
+        [queue removeObjectAtIndex:0];
+        runningCount++;
+        
+        [queueLock unlockWithCondition:[self queueCondition]];
+        
+        // Do it
+        
+        [task run];
+        [task release];
+        
+        [queueLock lock];
+        
+        runningCount--;
+        finishedCount++;
+        
+        [queueLock unlockWithCondition:[self queueCondition]];
+        
+        [pool release];
+    }
+}
+
+/********************/
+/* Progress methods */
+/********************/
+
+- (unsigned)threadCount
+{
+    return threadCount;
+}
+
+- (unsigned)pendingCount
+{
+    unsigned count;
+    
+    [queueLock lock];
+    count = [queue count] + runningCount;
+    [queueLock unlockWithCondition:[self queueCondition]];
+    
+    return count;
+}
+
+- (unsigned)finishedCount
+{
+    unsigned count;
+    
+    [queueLock lock];
+    count = finishedCount;
+    [queueLock unlockWithCondition:[self queueCondition]];
+    
+    return count;
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [queueLock release];
+    [queue release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
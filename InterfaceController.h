@@ -11,6 +11,7 @@
 
 #import <Foundation/Foundation.h>
 @class PreferenceController;  // This way, Xcode doesn't have to parse more files
+@class CPBackupController;
 
 /****************************/
 /* Declare global variables */
@@ -34,6 +35,10 @@ extern NSString *CP_OpenNewDoc;
 extern NSString *CP_NewDocFormat;
 extern NSString *CP_SaveBackup;
 extern NSString *CP_SaveBackupInterval;
+extern NSString *CP_LogPerformance;
+extern NSString *CP_AttachmentMemoryLimit;
+extern NSString *CP_FindIgnoresCase;
+extern NSString *CP_FindUsesRegularExpressions;
 
 // These are the keys used for custom toolbar items.
 
@@ -48,6 +53,10 @@ extern NSString *CP_OpenToolbarItemIdentifier;
 extern NSString *CP_PrefsToolbarItemIdentifier;
 extern NSString *CP_FindToolbarItemIdentifier;
 extern NSString *CP_FindNextToolbarItemIdentifier;
+extern NSString *CP_FindAllToolbarItemIdentifier;
+extern NSString *CP_FindInAllToolbarItemIdentifier;
+extern NSString *CP_ReplaceAllToolbarItemIdentifier;
+extern NSString *CP_MemoryToolbarItemIdentifier;
 extern NSString *CP_BackgroundColorToolbarItemIdentifier;
 extern NSString *CP_BiggerToolbarItemIdentifier;
 extern NSString *CP_SmallerToolbarItemIdentifier;
@@ -94,11 +103,13 @@ extern NSString *CP_TextFont;
     BOOL flag;
     
     NSTimer *backupTimer;  // The timer that will save a backup file at specified intervals
+    CPBackupController *backupController;  // Does the actual backing up
 }
 
 - (IBAction)showPreferencePanel:(id)sender;  // This will show the pref panel
 - (IBAction)showAboutPanel:(id)sender;
 - (void)createNewBackupTimer:(NSNotification *)notification;
+- (void)backupDocuments:(NSTimer *)timer;
 
 // These will trigger MyDocument's utility methods
 
@@ -107,6 +118,7 @@ extern NSString *CP_TextFont;
 - (IBAction)capitalize:(id)sender;
 - (IBAction)changeBackgroundColor:(id)sender;
 - (IBAction)wordCount:(id)sender;
+- (IBAction)memoryReport:(id)sender;
 - (IBAction)makeCPD:(id)sender;
 - (IBAction)makeRichText:(id)sender;
 - (IBAction)makeRTFD:(id)sender;
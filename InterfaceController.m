@@ -31,12 +31,19 @@
  - 06/07/05: FINALLY COMPLETED COCOAPAD 1.0!!!
  - 10/14/07: Fixed a bug that prevented CocoaPad from opening Word documents
  - 10/14/07: Released CocoaPad v1.1, with 2 bug fixes!
+ - 10/17/26: Moved Automatic Backup into CPBackupController, which only backs
+             up documents that changed, and writes them in the background.
+ - 10/17/26: Word count uses the document's statistics instead of making an
+             array of every word and character.  It shows lines now too.
+ - 10/17/26: Added the memory usage report.
  
  */
 
 #import "InterfaceController.h"
 #import "MyDocument.h"
 #import "PreferenceController.h"
+#import "CPBackupController.h"
+#import "CPDocumentStatistics.h"
 #import "LocalizedStrings.h"
 
 /****************************/
@@ -62,6 +69,10 @@ NSString *CP_OpenNewDoc = @"OpenNewDoc";
 NSString *CP_NewDocFormat = @"NewDocumentFormat";
 NSString *CP_SaveBackup = @"SaveBackup";
 NSString *CP_SaveBackupInterval = @"SaveBackupInterval";
+NSString *CP_LogPerformance = @"LogPerformance";  // Hidden -- logs timing info to the console
+NSString *CP_AttachmentMemoryLimit = @"AttachmentMemoryLimit";  // Hidden -- megabytes of decoded pictures per document
+NSString *CP_FindIgnoresCase = @"FindIgnoresCase";  // Set in the Replace All sheet
+NSString *CP_FindUsesRegularExpressions = @"FindUsesRegularExpressions";  // ...this too
 
 // These are for the document toolbar
 
@@ -76,6 +87,10 @@ NSString *CP_OpenToolbarItemIdentifier = @"OpenToolbarItemIdentifier";
 NSString *CP_PrefsToolbarItemIdentifier = @"PrefsToolbarItemIdentifier";
 NSString *CP_FindToolbarItemIdentifier = @"FindToolbarItemIdentifier";
 NSString *CP_FindNextToolbarItemIdentifier = @"FindNextToolbarItemIdentifier";
+NSString *CP_FindAllToolbarItemIdentifier = @"FindAllToolbarItemIdentifier";
+NSString *CP_FindInAllToolbarItemIdentifier = @"FindInAllToolbarItemIdentifier";
+NSString *CP_ReplaceAllToolbarItemIdentifier = @"ReplaceAllToolbarItemIdentifier";
+NSString *CP_MemoryToolbarItemIdentifier = @"MemoryToolbarItemIdentifier";
 NSString *CP_BackgroundColorToolbarItemIdentifier = @"BackgroundColorToolbarItemIdentifier";
 NSString *CP_BiggerToolbarItemIdentifier = @"BiggerToolbarItemIdentifier";
 NSString *CP_SmallerToolbarItemIdentifier = @"SmallerToolbarItemIdentifier";
@@ -134,6 +149,10 @@ NSString *CP_TextFont = @"Monaco";
     [defaultValues setObject:[NSNumber numberWithBool:YES] forKey:CP_OpenNewDoc];
     [defaultValues setObject:[NSNumber numberWithBool:YES] forKey:CP_SaveBackup];
     [defaultValues setObject:[NSNumber numberWithInt:5] forKey:CP_SaveBackupInterval];
+    [defaultValues setObject:[NSNumber numberWithBool:NO] forKey:CP_LogPerformance];
+    [defaultValues setObject:[NSNumber numberWithInt:64] forKey:CP_AttachmentMemoryLimit];
+    [defaultValues setObject:[NSNumber numberWithBool:NO] forKey:CP_FindIgnoresCase];
+    [defaultValues setObject:[NSNumber numberWithBool:NO] forKey:CP_FindUsesRegularExpressions];
     [defaultValues setObject:colorAsData forKey:CP_BackgroundColor];
     [defaultValues setObject:textColorAsData forKey:CP_TextColor];
     
@@ -160,6 +179,14 @@ NSString *CP_TextFont = @"Monaco";
     
     while (file = [backupFolder nextObject])
     {
+        // Skip anything CPBackupController didn't finish writing
+        
+        if ([[file lastPathComponent] hasPrefix:@"."])
+        {
+            [backupFolder skipDescendents];
+            continue;
+        }
+        
         backupsPurged = NO;
         
         if ([[file pathExtension] isEqualToString:@"rtfd"])
@@ -175,7 +202,7 @@ NSString *CP_TextFont = @"Monaco";
             
             // Create the document...
             
-            fileWrapper = [[NSFileWrapper alloc] initWithPath:[[[NSBundle mainBundle] bundlePath] stringByAppendingPathComponent:[NSString stringWithFormat:@"Contents/Resources/Backups/", file]]];
+            fileWrapper = [[NSFileWrapper alloc] initWithPath:[[[NSBundle mainBundle] bundlePath] stringByAppendingPathComponent:[NSString stringWithFormat:@"Contents/Resources/Backups/%@", file]]];
             
             document = [[NSDocumentController sharedDocumentController] openUntitledDocumentOfType:type display:YES];
             
@@ -260,6 +287,8 @@ NSString *CP_TextFont = @"Monaco";
         [[document currentWindow] makeKeyWindow];  // Return focus to the last document to open
     }
     
+    backupController = [[CPBackupController alloc] initWithBackupPath:[[[NSBundle mainBundle] bundlePath] stringByAppendingPathComponent:@"Contents/Resources/Backups"]];
+    
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(createNewBackupTimer:) name:@"BackupIntervalDidChange" object:nil];
     
     [self createNewBackupTimer:nil];
@@ -286,54 +315,8 @@ NSString *CP_TextFont = @"Monaco";
 
 - (void)backupDocuments:(NSTimer *)timer
 {
-    NSEnumerator *documentList = [[[NSDocumentController sharedDocumentController] documents] objectEnumerator];
-    MyDocument *document;
-    NSString *windowTitle, *backupPath = [[[NSBundle mainBundle] bundlePath] stringByAppendingPathComponent:@"Contents/Resources/Backups"];
-    
-    // First get rid of the old backups...
-    
-    if (![[NSFileManager defaultManager] removeFileAtPath:backupPath handler:nil])
-    {
-        NSLog(@"Something fishy happened when trying to purge the backup files...");
-    }
-    
-    // ...and create a fresh new backup folder
-    
-    [[NSFileManager defaultManager] createDirectoryAtPath:[[[NSBundle mainBundle] bundlePath] stringByAppendingPathComponent:@"Contents/Resources/Backups"] attributes:nil];
-    
-    // Run through all the documents and back 'em up!
-    
-    while (document = [documentList nextObject])
-    {
-        windowTitle = [[document currentWindow] title];
-        
-        // Save the text view contents
-        
-        if ([document cpd])
-        {
-            [[document fileWrapperRepresentationOfType:CP_CPDocument] writeToFile:[backupPath stringByAppendingPathComponent:[windowTitle stringByAppendingPathExtension:@"cpd"]] atomically:YES updateFilenames:YES];
-        }
-        
-        else if ([document rtf])
-        {
-            [[document fileWrapperRepresentationOfType:CP_RTFDocument] writeToFile:[backupPath stringByAppendingPathComponent:[windowTitle stringByAppendingPathExtension:@"rtf"]] atomically:YES updateFilenames:YES];
-        }
-        
-        else if ([document rtfd])
-        {
-            [[document fileWrapperRepresentationOfType:CP_RTFDDocument] writeToFile:[backupPath stringByAppendingPathComponent:[windowTitle stringByAppendingPathExtension:@"rtfd"]] atomically:YES updateFilenames:YES];
-        }
-        
-        else if ([document doc] && [document supportsWordFormat])
-        {
-            [[document fileWrapperRepresentationOfType:CP_WordDocument] writeToFile:[backupPath stringByAppendingPathComponent:[windowTitle stringByAppendingPathExtension:@"doc"]] atomically:YES updateFilenames:YES];
-        }
-        
-        else if ([document plainText])
-        {
-            [[document fileWrapperRepresentationOfType:CP_TextDocument] writeToFile:[backupPath stringByAppendingPathComponent:[windowTitle stringByAppendingPathExtension:@"txt"]] atomically:YES updateFilenames:YES];
-        }
-    }
+    // CPBackupController only writes the documents that changed
+    [backupController backupDocuments];
 }
 
 /***** Validate menu items when asked for *****/
@@ -493,15 +476,40 @@ NSString *CP_TextFont = @"Monaco";
     
     if (document != nil)
     {
-        // Get the word count
-        int words = [[textStorage words] count];
-        int paragraphs = [[textStorage paragraphs] count];
-        int chars = [[textStorage characters] count];
+        // Get the word count (it's kept up to date as the document is edited)
+        
+        NSDate *start = [NSDate date];
+        CPDocumentStatistics *statistics = [document statistics];
+        int words = [statistics wordCount];
+        int paragraphs = [statistics paragraphCount];
+        int chars = [statistics characterCount];
+        int lines = [statistics lineCount];
         
-        NSBeginInformationalAlertSheet(L_WORD_COUNT_TITLE, L_OK_BUTTON, nil, nil, [document currentWindow], self, nil, nil, nil, [NSString stringWithFormat:L_WORD_COUNT_TEXT, chars, words, paragraphs], nil);
+        if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+        {
+            // Compare with the way we used to do it
+            
+            NSTimeInterval time = -[start timeIntervalSinceNow];
+            NSDate *arrayStart = [NSDate date];
+            int arrayWords = [[textStorage words] count];
+            int arrayParagraphs = [[textStorage paragraphs] count];
+            int arrayChars = [[textStorage characters] count];
+            
+            NSLog(@"Word count: %d/%d/%d/%d in %.4f sec (text storage arrays: %d/%d/%d in %.4f sec)", chars, words, paragraphs, lines, time, arrayChars, arrayWords, arrayParagraphs, -[arrayStart timeIntervalSinceNow]);
+        }
+        
+        NSBeginInformationalAlertSheet(L_WORD_COUNT_TITLE, L_OK_BUTTON, nil, nil, [document currentWindow], self, nil, nil, nil, [NSString stringWithFormat:L_WORD_COUNT_TEXT, chars, words, paragraphs, lines], nil);
     }
 }
 
+/***** Memory usage *****/
+
+- (IBAction)memoryReport:(id)sender
+{
+    // Only if there's a document open to show it on
+    [[[NSDocumentController sharedDocumentController] currentDocument] showMemoryReport];
+}
+
 //
 // Format conversion methods
 //
@@ -631,6 +639,8 @@ NSString *CP_TextFont = @"Monaco";
 
 - (void)applicationWillTerminate:(NSNotification *)notification
 {
+    [backupController waitUntilIdle];  // Don't pull the folder out from under the writer thread
+    
     if (![[NSFileManager defaultManager] removeFileAtPath:[[[NSBundle mainBundle] bundlePath] stringByAppendingPathComponent:@"Contents/Resources/Backups"] handler:nil])
     {
         NSLog(@"Something fishy happened when trying to purge the backup data...");
@@ -644,6 +654,7 @@ NSString *CP_TextFont = @"Monaco";
 - (void)dealloc:(id)sender
 {
     [preferenceController release];  // We must deallocate our instance of PreferenceController
+    [backupController release];
     [super dealloc];  // ...we now return to the previously scheduled deallocation. 
 }
 
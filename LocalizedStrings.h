@@ -36,11 +36,26 @@
 #define L_UNDO_UPPERCASE_ITEM_TITLE NSLocalizedString(@"Capitalization", @"Title for undo uppercasing menu item")
 #define L_UNDO_LOWERCASE_ITEM_TITLE NSLocalizedString(@"Make Text Lowercase", @"Title for undo lowercasing menu item")
 #define L_UNDO_CAPITALIZE_ITEM_TITLE NSLocalizedString(@"First Letter Capitalization", @"Title for undo capitalizing menu item")
+#define L_UNDO_REPLACE_ALL_ITEM_TITLE NSLocalizedString(@"Replace All", @"Title for undo replace all menu item")
 
 // Sheet strings
 
 #define L_WORD_COUNT_TITLE NSLocalizedString(@"Word Count", @"Title for the word count sheet.")
-#define L_WORD_COUNT_TEXT NSLocalizedString(@"Characters:\t%d\nWords:\t\t%d\nParagraphs:\t%d", @"Text used in the word count sheet.")
+#define L_WORD_COUNT_TEXT NSLocalizedString(@"Characters:\t%d\nWords:\t\t%d\nParagraphs:\t%d\nLines:\t\t%d", @"Text used in the word count sheet.")
+#define L_FIND_ALL_TEXT NSLocalizedString(@"Found %u matches in %@.", @"Summary at the top of the find results panel, for Find All.")
+#define L_FIND_ALL_DOCUMENTS_TEXT NSLocalizedString(@"Found %u matches in %u of %u documents.", @"Summary at the top of the find results panel, for Find in All Documents.")
+#define L_FIND_RESULTS_TITLE NSLocalizedString(@"Find Results", @"Title for the find results panel.")
+#define L_FIND_RESULTS_LIMIT_TEXT NSLocalizedString(@"%@  Only the first %u are listed.", @"Added to the find results summary when there are too many matches to list.")
+#define L_FIND_RESULTS_DOCUMENT_COLUMN NSLocalizedString(@"Document", @"Document column in the find results panel.")
+#define L_FIND_RESULTS_LINE_COLUMN NSLocalizedString(@"Line", @"Line column in the find results panel.")
+#define L_FIND_RESULTS_TEXT_COLUMN NSLocalizedString(@"Text", @"Text column in the find results panel.")
+#define L_REPLACE_ALL_SHEET_TEXT NSLocalizedString(@"Replace every \\U201c%@\\U201d with:", @"Text in the Replace All sheet.")
+#define L_IGNORE_CASE_CHECKBOX NSLocalizedString(@"Ignore Case", @"Ignore Case checkbox in the Replace All sheet.")
+#define L_REGULAR_EXPRESSION_CHECKBOX NSLocalizedString(@"Regular Expression", @"Regular Expression checkbox in the Replace All sheet.")
+#define L_MEMORY_REPORT_TITLE NSLocalizedString(@"Memory Usage", @"Title for the memory usage sheet.")
+#define L_MEMORY_REPORT_TEXT NSLocalizedString(@"%@\n\tText:\t\t%u characters (%.1f MB)\n\tPictures:\t%u of %u decoded (%.1f MB, the limit is %.1f MB)\n\tPicture files:\t%.1f MB (only read when needed)", @"Text used for each document in the memory usage sheet.")
+#define L_EXPORTING_TEXT NSLocalizedString(@"Converting to %@\\U2026", @"Text in the sheet shown while a converted document is encoded in the background")
+#define L_MEMORY_REPORT_TOTAL NSLocalizedString(@"Total:\t%.1f MB in %u documents", @"Text used at the end of the memory usage sheet.")
 #define L_CONVERT_RTF_SHEET_TITLE NSLocalizedString(@"Are you sure you want to convert your document to Rich Text Format?", @"Title of the RTF format conversion sheet")
 #define L_CONVERT_RTF_SHEET_DESCRIPTION NSLocalizedString(@"This will strip your document of all graphics, but leave formatting intact.", @"Description of the RTF format conversion sheet")
 #define L_CONVERT_WORD_SHEET_TITLE NSLocalizedString(@"Are you sure you want to convert your document to Microsoft Word format?", @"Title of the Word format conversion sheet")
@@ -85,6 +100,14 @@
 #define L_FIND_HELP_TAG NSLocalizedString(@"Shows the find and replace panel", @"Find help tag (Panther and up)")
 #define L_FIND_NEXT_TOOLBAR_ITEM NSLocalizedString(@"Find Next", @"Find Next toolbar item (Panther and up)")
 #define L_FIND_NEXT_HELP_TAG NSLocalizedString(@"Highlights the next occurance of whatever text you are Finding", @"Find Next help tag (Panther and up)")
+#define L_FIND_ALL_TOOLBAR_ITEM NSLocalizedString(@"Find All", @"Find All toolbar item")
+#define L_FIND_ALL_HELP_TAG NSLocalizedString(@"Selects every occurrence of whatever text you are Finding", @"Find All help tag")
+#define L_FIND_IN_ALL_TOOLBAR_ITEM NSLocalizedString(@"Find in All", @"Find in All Documents toolbar item")
+#define L_FIND_IN_ALL_HELP_TAG NSLocalizedString(@"Selects whatever text you are Finding in every open document", @"Find in All Documents help tag")
+#define L_REPLACE_ALL_TOOLBAR_ITEM NSLocalizedString(@"Replace All\\U2026", @"Replace All toolbar item")
+#define L_REPLACE_ALL_HELP_TAG NSLocalizedString(@"Replaces every occurrence of whatever text you are Finding at once", @"Replace All help tag")
+#define L_MEMORY_TOOLBAR_ITEM NSLocalizedString(@"Memory Usage", @"Memory Usage toolbar item")
+#define L_MEMORY_HELP_TAG NSLocalizedString(@"Shows how much memory the open documents are using", @"Memory Usage help tag")
 #define L_CHANGE_BG_COLOR_TOOLBAR_ITEM NSLocalizedString(@"Change Background", @"Change background color toolbar item")
 #define L_CHANGE_BG_COLOR_HELP_TAG NSLocalizedString(@"Brings up a color panel, where you can change the document's background color", @"Change background color help tag")
 #define L_BIGGER_TOOLBAR_ITEM NSLocalizedString(@"Bigger", @"Bigger size toolbar item")
@@ -11,6 +11,26 @@
 
 #import <Cocoa/Cocoa.h>
 #import "CPTextView.h"
+#import "CPDocumentCodec.h"
+
+@class CPDocumentStatistics;
+@class CPWorkerTask;
+@class CPPreferenceSnapshot;
+@class CPTextSearch;
+@class CPAttachmentCache;
+
+/*************/
+/* Constants */
+/*************/
+
+// The case changes (see changeCaseOfSelection:)
+
+typedef enum
+{
+    CPUppercase,
+    CPLowercase,
+    CPCapitalize
+} CPCaseChange;
 
 /**********************************/
 /* Instance variables and Methods */
@@ -20,10 +40,38 @@
 {
     IBOutlet CPTextView *textView;  // The text view
     NSTextStorage *textStorage;  // The text storage
-    NSData *fileContents;  // RTF/RTFD/Word data
+    NSData *fileContents;  // CPD/RTF/Word data (only until it's loaded)
+    NSFileWrapper *fileWrapper;  // RTFD package (only until it's loaded)
     NSColor *documentTextColor;  // Used to prevent other color panels from changing the text color
-    NSString *string;  // Text contents
+    NSString *string;  // Text to load (recovered backups), until it's in the text view
+    CPDocumentStatistics *statistics;  // Word count, etc. (made the first time someone asks)
+    CPAttachmentCache *attachmentCache;  // Decodes pictures only when they're drawn
+    
+    // Encoding in the background after a conversion
+    
+    unsigned long changeGeneration;  // Goes up every time the text changes
+    CPWorkerTask *exportTask;  // The encoding that's still running
+    NSFileWrapper *exportWrapper;  // What it came up with, ready for saving
+    CPDocumentFormat exportFormat;  // What format it's in
+    NSPanel *exportSheet;  // Shows it's still going (only if it takes a while)
+    NSProgressIndicator *exportProgress;
+    
+    // The Replace All sheet (only while it's up)
+    
+    NSPanel *replaceSheet;
+    NSTextField *replaceField;
+    NSButton *replaceIgnoresCase;
+    NSButton *replaceUsesRegularExpressions;
+    CPTextSearch *replaceSearch;  // What it's replacing
+    
+    // Plain text files are read right out of the file (see CPPieceTableStorage)
+    
+    NSData *textData;  // The (memory mapped) file, until it's loaded
+    NSStringEncoding textEncoding;  // What encoding it's in
+    unsigned textLocation;  // Where the text starts (after the byte order mark)
+    NSLayoutManager *detachedLayoutManager;  // Taken off the text storage while loading
     BOOL untitledDocument;  // Is the document untitled (for text files)?
+    BOOL needsBackup;  // Has the document changed since Automatic Backup last saved it?
     
     // The format flags
     
@@ -55,31 +103,67 @@
 - (BOOL)rtfd;
 - (BOOL)doc;
 - (void)setType:(NSString *)type;
+- (CPDocumentFormat)format;
++ (CPDocumentFormat)formatForType:(NSString *)type;
 
 - (BOOL)supportsWordFormat;
 
 - (NSWindow *)currentWindow;
 - (NSTextView *)textView;
 - (NSString *)selectedText;
+- (NSAttributedString *)textSnapshot;  // An unchanging copy of the text, for saving in the background
+- (CPDocumentStatistics *)statistics;
+- (CPAttachmentCache *)attachmentCache;
 - (void)setFileWrapper:(NSFileWrapper *)fileWrapper;
 - (void)setFileContents:(NSData *)data;
 
+// Automatic Backup
+
+- (BOOL)needsBackup;
+- (void)setNeedsBackup:(BOOL)flag;
+
 // The one read/write method that needs to be declared
 
 - (void)loadDocument;
+- (void)loadRichTextOfFormat:(CPDocumentFormat)format;
+
+// Encoding in the background
+
+- (void)startExport;  // Encode the text in the current format on the worker pool
+- (BOOL)isExporting;
+- (void)cancelExport:(id)sender;  // The progress sheet's Cancel button
+- (void)exportDidFinish:(CPWorkerTask *)task;  // Only on the main thread
+
+// Loading helpers
+
+- (BOOL)readPlainTextFromFile:(NSString *)fileName;
+- (void)beginLoading;  // Take the layout manager off while we fill the text storage
+- (void)endLoading;  // Put it back on
 
 /***** Utility methods *****/
 
 - (void)updateView;  // Update the interface when necessary
+- (BOOL)applyPreferences:(CPPreferenceSnapshot *)prefs;  // Returns NO if nothing had to change
+- (BOOL)allTextHasAttribute:(NSString *)name value:(id)value;
 - (void)updateString;  // Update the plain text string when necessary
 
 // Utilities
 
-- (void)uppercase:(NSAttributedString *)attributedString;
-- (void)lowercase:(NSAttributedString *)attributedString;
-- (void)capitalize:(NSAttributedString *)attributedString;
+- (void)uppercase:(id)sender;
+- (void)lowercase:(id)sender;
+- (void)capitalize:(id)sender;
+- (void)changeCaseOfSelection:(CPCaseChange)caseChange;
+- (void)replaceTextInRange:(NSRange)range withAttributedString:(NSAttributedString *)text actionName:(NSString *)actionName;  // Undoable
+- (void)replaceTextInRanges:(NSData *)ranges withText:(NSAttributedString *)text lengths:(NSData *)lengths actionName:(NSString *)actionName;  // Undoable, in one step
 - (void)changeBackgroundColor;
 
+// Finding and replacing (see CPTextSearch)
+
+- (CPTextSearch *)findPanelSearch;  // Whatever's in the find panel
+- (unsigned)replaceAll:(CPTextSearch *)search withString:(NSString *)replacement;  // Returns how many were replaced
+- (void)selectRanges:(NSData *)ranges;
+- (void)showReplaceSheet;  // Asks what to replace the find panel's text with
+
 // Format conversion utilities
 
 - (void)convertToCPD;
@@ -89,7 +173,14 @@
 - (void)convertToTXT;
 
 - (BOOL)containsFormatting;  // See if the document is not plain text or no
+- (BOOL)isPlainTextCompatible;  // Could it be plain text without losing anything?
 - (NSDictionary *)defaultTextAttributes;  // Get the default text attributes
 - (void)removeAttachments;  // This removes all attachments, graphics, etc.
 
+// Memory usage
+
+- (NSString *)memoryFootprint;  // One document's part of the memory report
+- (unsigned long)memoryBytes;  // About how much it's using
+- (void)showMemoryReport;  // For every open document
+
 @end
\ No newline at end of file
@@ -105,6 +105,66 @@
  - 10/14/07: Fixed the bug that makes the cursor reverts to the place where
              you last typed after saving.
  - 10/14/07: Released CocoaPad v1.1, with 2 bug fixes!
+ - 10/17/26: Documents now remember if they changed since the last automatic
+             backup, so unchanged documents aren't backed up again.
+ - 10/17/26: Moved the encoding code to CPDocumentCodec.  Saving no longer
+             strips attachments out of the document, clears the undo history,
+             or updates the text view.
+ - 10/17/26: Plain text files are now memory mapped and loaded a piece at a
+             time, so the first screen shows up before the rest is loaded.
+ - 10/17/26: Opening a document only parses it once now, right into the text
+             storage.  RTFD packages aren't converted to RTFD data first, and
+             the file data is let go as soon as it's loaded.
+ - 10/17/26: Rewrote uppercase/lowercase/capitalize.  They keep the formatting
+             of every run, and undo only saves the text that changed instead
+             of a (leaked) copy of the whole document.
+ - 10/17/26: Added statistics, which keeps the word count up to date as the
+             document is edited.
+ - 10/17/26: Converting a document starts encoding it in the new format on
+             the worker pool, and saving uses that if the text hasn't changed
+             since.
+ - 10/17/26: Added applyPreferences: for Apply to All, which only changes what
+             doesn't already match the preferences.
+ - 10/17/26: The default text attributes and colors come from the shared
+             CPPreferenceSnapshot, and containsFormatting stops at the first
+             run plain text can't keep.
+ - 10/17/26: Plain text files are kept in a CPPieceTableStorage, which reads
+             right out of the mapped file, so they're all there as soon as
+             they're opened, edits in the middle of huge files are fast, and
+             saving writes the pieces straight to disk.  The string is no
+             longer copied out of the text view after every change.
+ - 10/17/26: Added Find All and Find in All Documents, which use CPTextSearch
+             to find every match at once (in all of the documents at the same
+             time), and replaceAll:withString:, which makes every replacement
+             in one edit that can be undone in one step.
+ - 10/17/26: Pictures in CPD and RTFD documents are only decoded when
+             they're drawn, and CPAttachmentCache keeps the decoded ones
+             under a memory limit.  RTFD packages are memory mapped, so
+             saving copies the pictures straight from the old files.
+             Added a memory usage report for the open documents.
+ - 10/17/26: Saving waits for the background encoding if it's still running
+             (instead of doing it all again), and a sheet shows its progress
+             if it takes a while, with a button to cancel it.  Closing the
+             document lets go of the encoding.
+ - 10/17/26: Find All and Find in All Documents list their matches in the
+             find results panel (see CPFindResultsController).  Added a
+             Replace All toolbar item, which asks what to replace the find
+             panel's text with in a sheet.
+ - 10/17/26: The background encoding doesn't hold on to the document
+             anymore (so it's never let go of on a worker thread), and
+             saving only waits for it if it's already running -- if it's
+             still stuck behind other documents' encodings, saving takes it
+             back and does the encoding itself.
+ - 10/17/26: Saving as RTF, Word, or plain text takes the pictures out of
+             the window too (like it used to), so what's on screen is what
+             got saved.
+ - 10/17/26: Capitalize finds words the same way whether or not there are
+             accented letters in the text ("don't" used to become "Don'T"
+             next to an accented letter).
+ - 10/17/26: The Replace All sheet has Ignore Case and Regular Expression
+             checkboxes, which Find All and Find in All Documents use too
+             (Ignore Case comes from the find panel when it says).  Closing
+             a document takes its matches out of the find results panel.
  
  Working on:
  
@@ -117,10 +177,23 @@
 #import "MyDocument.h"
 #import "InterfaceController.h"
 #import "LocalizedStrings.h"
+#import "CPDocumentStatistics.h"
+#import "CPWorkerPool.h"
+#import "CPPreferenceSnapshot.h"
+#import "CPPieceTableStorage.h"
+#import "CPTextSearch.h"
+#import "CPAttachmentCache.h"
+#import "CPFindResultsController.h"
 
 // For AppKit's extension to NSAttributedString
 #import <AppKit/NSAttributedString.h>
 
+/*************/
+/* Constants */
+/*************/
+
+#define CP_ExportSheetDelay 0.5  // How long an encoding runs before we show its progress (in seconds)
+
 
 @implementation MyDocument
 
@@ -195,6 +268,7 @@
 {
     [textView setDelegate:self];
     [[textView layoutManager] setDelegate:self];
+    [[textView textStorage] setDelegate:self];
     [[textView window] setTitle:L_LOADING_WINDOW_TITLE];  // Make the title bar temporarily say "Loading..."
     textStorage = [textView textStorage];  // Initialize the text storage
     
@@ -226,8 +300,8 @@
 - (void)windowControllerDidLoadNib:(NSWindowController *)aController
 {
     NSUserDefaults *prefs = [NSUserDefaults standardUserDefaults];  // Load the preferences
-    NSColor *textColor = [NSUnarchiver unarchiveObjectWithData:[prefs objectForKey:CP_TextColor]];
-    NSColor *backgroundColor = [NSUnarchiver unarchiveObjectWithData:[prefs objectForKey:CP_BackgroundColor]];
+    NSColor *textColor = [[CPPreferenceSnapshot currentSnapshot] textColor];
+    NSColor *backgroundColor = [[CPPreferenceSnapshot currentSnapshot] backgroundColor];
     NSToolbar *toolbar = [[[NSToolbar alloc] initWithIdentifier:CP_ToolbarIdentifier] autorelease];  // Create a new toolbar
     NSArray *tabStops;  // Tab stops will be assigned after document is loaded
     BOOL showRuler = [prefs boolForKey:CP_ShowRuler];  // Get the ruler settings
@@ -324,7 +398,9 @@
 
 - (NSString *)string
 {
-    return string;
+    // Once it's loaded, the text storage has it
+    
+    return (string != nil) ? string : [textStorage string];
 }
 
 - (void)setString:(NSString *)value
@@ -346,13 +422,10 @@
 {
     // We'll use a retain then release
     
-    // Get the data from the RTFD document
-    NSAttributedString *tempString = [[[NSAttributedString alloc] initWithRTFDFileWrapper:wrapper documentAttributes:nil] retain];
-        
-    [fileContents release];
-        
-    // This is shorter version of "Retain, then Release"
-    fileContents = [tempString RTFDFromRange:NSMakeRange(0, [tempString length]) documentAttributes:nil];
+    [wrapper retain];
+    [fileWrapper release];
+    
+    fileWrapper = wrapper;
     
     [self loadDocument];
 }
@@ -452,6 +525,65 @@
     return supportsWordFormat;
 }
 
+/***** The format flags as a CPDocumentCodec format *****/
+
+- (CPDocumentFormat)format
+{
+    if (cpd)
+        return CPFormatCPD;
+    
+    else if (rtf)
+        return CPFormatRTF;
+    
+    else if (rtfd)
+        return CPFormatRTFD;
+    
+    else if (doc)
+        return CPFormatWord;
+    
+    else if (plainText)
+        return CPFormatText;
+    
+    return CPFormatUnknown;
+}
+
++ (CPDocumentFormat)formatForType:(NSString *)type
+{
+    if ([type isEqualToString:CP_CPDocument])
+        return CPFormatCPD;
+    
+    else if ([type isEqualToString:CP_RTFDocument])
+        return CPFormatRTF;
+    
+    else if ([type isEqualToString:CP_RTFDDocument])
+        return CPFormatRTFD;
+    
+    else if ([type isEqualToString:CP_WordDocument])
+        return CPFormatWord;
+    
+    else if ([type isEqualToString:CP_TextDocument])
+        return CPFormatText;
+    
+    return CPFormatUnknown;
+}
+
+/***** Automatic Backup flag *****/
+
+/*
+ * CPBackupController only backs up documents that have
+ * this set, and clears it once it took a snapshot.
+ */
+
+- (BOOL)needsBackup
+{
+    return needsBackup;
+}
+
+- (void)setNeedsBackup:(BOOL)flag
+{
+    needsBackup = flag;
+}
+
 /***** Return the selected text *****/
 
 /*
@@ -475,6 +607,55 @@
     }
 }
 
+/***** Take a snapshot of the text *****/
+
+/*
+ * The copy doesn't change when the user keeps typing, so
+ * CPDocumentCodec can encode it on another thread.
+ */
+
+- (NSAttributedString *)textSnapshot
+{
+    return [[textStorage copy] autorelease];
+}
+
+/***** The word count, etc. *****/
+
+/*
+ * Most documents never get counted, so we don't start keeping
+ * track until the first time someone asks.  From then on, the
+ * counts are updated as the document is edited.
+ */
+
+- (CPDocumentStatistics *)statistics
+{
+    if (statistics == nil)
+    {
+        statistics = [[CPDocumentStatistics alloc] initWithTextStorage:textStorage];
+    }
+    
+    return statistics;
+}
+
+/***** The pictures *****/
+
+/*
+ * Made the first time someone asks (usually when a document with
+ * pictures is loaded).  The limit is a hidden preference, in
+ * megabytes.
+ */
+
+- (CPAttachmentCache *)attachmentCache
+{
+    if (attachmentCache == nil)
+    {
+        unsigned limit = [[NSUserDefaults standardUserDefaults] integerForKey:CP_AttachmentMemoryLimit];
+        attachmentCache = [[CPAttachmentCache alloc] initWithMemoryLimit:limit * 1024 * 1024];
+    }
+    
+    return attachmentCache;
+}
+
 - (NSWindow *)currentWindow
 {
     return [textView window];  // Return the current document's window
@@ -520,6 +701,10 @@
         CP_ConvertToRTFDToolbarItemIdentifier,
         CP_ConvertToTXTToolbarItemIdentifier,
         CP_ConvertToDocToolbarItemIdentifier,
+        CP_FindAllToolbarItemIdentifier,
+        CP_FindInAllToolbarItemIdentifier,
+        CP_ReplaceAllToolbarItemIdentifier,
+        CP_MemoryToolbarItemIdentifier,
         NSToolbarPrintItemIdentifier,
         NSToolbarCustomizeToolbarItemIdentifier,
         NSToolbarSeparatorItemIdentifier,
@@ -659,6 +844,42 @@
         [toolbarItem setAction:@selector(findNext)];
     }
     
+    else if ([itemIdentifier isEqualToString:CP_FindAllToolbarItemIdentifier])
+    {
+        [toolbarItem setLabel:L_FIND_ALL_TOOLBAR_ITEM];
+        [toolbarItem setPaletteLabel:L_FIND_ALL_TOOLBAR_ITEM];
+        [toolbarItem setToolTip:L_FIND_ALL_HELP_TAG];
+        [toolbarItem setImage:[NSImage imageNamed:@"find"]];
+        [toolbarItem setAction:@selector(findAll)];
+    }
+    
+    else if ([itemIdentifier isEqualToString:CP_FindInAllToolbarItemIdentifier])
+    {
+        [toolbarItem setLabel:L_FIND_IN_ALL_TOOLBAR_ITEM];
+        [toolbarItem setPaletteLabel:L_FIND_IN_ALL_TOOLBAR_ITEM];
+        [toolbarItem setToolTip:L_FIND_IN_ALL_HELP_TAG];
+        [toolbarItem setImage:[NSImage imageNamed:@"findnext"]];
+        [toolbarItem setAction:@selector(findInAllDocuments)];
+    }
+    
+    else if ([itemIdentifier isEqualToString:CP_ReplaceAllToolbarItemIdentifier])
+    {
+        [toolbarItem setLabel:L_REPLACE_ALL_TOOLBAR_ITEM];
+        [toolbarItem setPaletteLabel:L_REPLACE_ALL_TOOLBAR_ITEM];
+        [toolbarItem setToolTip:L_REPLACE_ALL_HELP_TAG];
+        [toolbarItem setImage:[NSImage imageNamed:@"find"]];
+        [toolbarItem setAction:@selector(showReplaceSheet)];
+    }
+    
+    else if ([itemIdentifier isEqualToString:CP_MemoryToolbarItemIdentifier])
+    {
+        [toolbarItem setLabel:L_MEMORY_TOOLBAR_ITEM];
+        [toolbarItem setPaletteLabel:L_MEMORY_TOOLBAR_ITEM];
+        [toolbarItem setToolTip:L_MEMORY_HELP_TAG];
+        [toolbarItem setImage:[NSApp applicationIconImage]];
+        [toolbarItem setAction:@selector(showMemoryReport)];
+    }
+    
     else if ([itemIdentifier isEqualToString:CP_BiggerToolbarItemIdentifier])
     {
         [toolbarItem setLabel:L_BIGGER_TOOLBAR_ITEM];
@@ -914,6 +1135,253 @@
     }
 }
 
+/***** Find All *****/
+
+/*
+ * Selects every match of whatever's in the find panel (or the
+ * selection, if nothing's been searched for yet) at once, and
+ * lists them in the find results panel.
+ */
+
+- (void)findAll
+{
+    CPTextSearch *search = [self findPanelSearch];
+    NSData *ranges;
+    
+    if (search == nil)
+    {
+        NSBeep();
+        return;
+    }
+    
+    ranges = [search rangesInString:[textStorage string]];
+    
+    if ([ranges length] == 0)
+    {
+        NSBeep();
+        return;
+    }
+    
+    [self selectRanges:ranges];
+    
+    [[CPFindResultsController sharedController] showMatches:[NSArray arrayWithObject:ranges] inDocuments:[NSArray arrayWithObject:self] summary:[NSString stringWithFormat:L_FIND_ALL_TEXT, (unsigned)([ranges length] / sizeof(NSRange)), [self displayName]]];
+}
+
+/***** Find in All Documents *****/
+
+/*
+ * The same thing, in every open document.  They're all searched
+ * at the same time, and all of the matches go in one list.
+ */
+
+- (void)findInAllDocuments
+{
+    CPTextSearch *search = [self findPanelSearch];
+    NSArray *documents = [[NSDocumentController sharedDocumentController] documents];
+    NSMutableArray *strings = [NSMutableArray arrayWithCapacity:[documents count]];
+    NSDate *start = [NSDate date];
+    unsigned total = 0, found = 0, i;
+    NSArray *results;
+    
+    if (search == nil)
+    {
+        NSBeep();
+        return;
+    }
+    
+    for (i = 0; i < [documents count]; i++)
+    {
+        [strings addObject:[[[documents objectAtIndex:i] textView] string]];
+    }
+    
+    results = [search rangesInStrings:strings];
+    
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+    {
+        NSLog(@"Searched %u documents in %.3f sec", [documents count], -[start timeIntervalSinceNow]);
+    }
+    
+    for (i = 0; i < [documents count]; i++)
+    {
+        NSData *ranges = [results objectAtIndex:i];
+        
+        if ([ranges length] > 0)
+        {
+            [[documents objectAtIndex:i] selectRanges:ranges];
+            
+            total += [ranges length] / sizeof(NSRange);
+            found++;
+        }
+    }
+    
+    if (total == 0)
+        NSBeep();
+    
+    [[CPFindResultsController sharedController] showMatches:results inDocuments:documents summary:[NSString stringWithFormat:L_FIND_ALL_DOCUMENTS_TEXT, total, found, [documents count]]];
+}
+
+/***** Replace All *****/
+
+/*
+ * Asks what to replace whatever's in the find panel with, in a
+ * small sheet, and then replaces every match at once (see
+ * replaceAll:withString:), so it's one edit and one undo.
+ */
+
+- (void)showReplaceSheet
+{
+    CPTextSearch *search = [self findPanelSearch];
+    NSView *content;
+    NSTextField *label;
+    NSButton *button;
+    
+    if (search == nil || replaceSheet != nil)
+    {
+        NSBeep();
+        return;
+    }
+    
+    replaceSearch = [search retain];
+    
+    replaceSheet = [[NSPanel alloc] initWithContentRect:NSMakeRect(0, 0, 400, 142) styleMask:NSTitledWindowMask backing:NSBackingStoreBuffered defer:YES];
+    [replaceSheet setReleasedWhenClosed:NO];  // We release it ourselves
+    content = [replaceSheet contentView];
+    
+    label = [[[NSTextField alloc] initWithFrame:NSMakeRect(20, 106, 360, 17)] autorelease];
+    [label setStringValue:[NSString stringWithFormat:L_REPLACE_ALL_SHEET_TEXT, [search pattern]]];
+    [label setEditable:NO];
+    [label setSelectable:NO];
+    [label setBezeled:NO];
+    [label setDrawsBackground:NO];
+    [content addSubview:label];
+    
+    replaceField = [[NSTextField alloc] initWithFrame:NSMakeRect(20, 78, 360, 22)];
+    [content addSubview:replaceField];
+    
+    // How to search (these start out the way Find All would search)
+    
+    replaceIgnoresCase = [[NSButton alloc] initWithFrame:NSMakeRect(18, 50, 160, 18)];
+    [replaceIgnoresCase setButtonType:NSSwitchButton];
+    [replaceIgnoresCase setTitle:L_IGNORE_CASE_CHECKBOX];
+    [replaceIgnoresCase setState:([search options] & CPSearchCaseInsensitive) ? NSOnState : NSOffState];
+    [content addSubview:replaceIgnoresCase];
+    
+    replaceUsesRegularExpressions = [[NSButton alloc] initWithFrame:NSMakeRect(182, 50, 200, 18)];
+    [replaceUsesRegularExpressions setButtonType:NSSwitchButton];
+    [replaceUsesRegularExpressions setTitle:L_REGULAR_EXPRESSION_CHECKBOX];
+    [replaceUsesRegularExpressions setState:([search options] & CPSearchRegularExpression) ? NSOnState : NSOffState];
+    [replaceUsesRegularExpressions setEnabled:[CPTextSearch supportsRegularExpressions]];
+    [content addSubview:replaceUsesRegularExpressions];
+    
+    button = [[[NSButton alloc] initWithFrame:NSMakeRect(284, 12, 102, 32)] autorelease];
+    [button setBezelStyle:NSRoundedBezelStyle];
+    [button setTitle:L_UNDO_REPLACE_ALL_ITEM_TITLE];  // The same words as the undo item
+    [button setKeyEquivalent:@"\r"];
+    [button setTag:NSOKButton];
+    [button setTarget:self];
+    [button setAction:@selector(endReplaceSheet:)];
+    [content addSubview:button];
+    
+    button = [[[NSButton alloc] initWithFrame:NSMakeRect(182, 12, 102, 32)] autorelease];
+    [button setBezelStyle:NSRoundedBezelStyle];
+    [button setTitle:L_CANCEL_BUTTON];
+    [button setKeyEquivalent:@"\033"];  // Escape
+    [button setTag:NSCancelButton];
+    [button setTarget:self];
+    [button setAction:@selector(endReplaceSheet:)];
+    [content addSubview:button];
+    
+    [replaceSheet setInitialFirstResponder:replaceField];
+    
+    [NSApp beginSheet:replaceSheet modalForWindow:[self currentWindow] modalDelegate:self didEndSelector:@selector(replaceSheetDidEnd:returnCode:contextInfo:) contextInfo:NULL];
+}
+
+/***** One of the Replace All sheet's buttons was clicked *****/
+
+- (void)endReplaceSheet:(id)sender
+{
+    [NSApp endSheet:replaceSheet returnCode:[sender tag]];
+}
+
+/***** Do the replacing (or not) *****/
+
+- (void)replaceSheetDidEnd:(NSWindow *)sheet returnCode:(int)returnCode contextInfo:(void *)contextInfo
+{
+    [sheet orderOut:nil];
+    
+    if (returnCode == NSOKButton)
+    {
+        NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+        BOOL ignoresCase = ([replaceIgnoresCase state] == NSOnState);
+        BOOL usesRegularExpressions = ([replaceUsesRegularExpressions state] == NSOnState);
+        CPTextSearch *search;
+        
+        // Remember them for next time (and for Find All)
+        
+        [defaults setBool:ignoresCase forKey:CP_FindIgnoresCase];
+        [defaults setBool:usesRegularExpressions forKey:CP_FindUsesRegularExpressions];
+        
+        search = [[[CPTextSearch alloc] initWithPattern:[replaceSearch pattern] options:((ignoresCase) ? CPSearchCaseInsensitive : 0) | ((usesRegularExpressions) ? CPSearchRegularExpression : 0)] autorelease];
+        
+        if (search == nil || [self replaceAll:search withString:[replaceField stringValue]] == 0)
+            NSBeep();  // A bad regular expression, or nothing to replace
+    }
+    
+    [replaceSheet release];
+    replaceSheet = nil;
+    [replaceField release];
+    replaceField = nil;
+    [replaceIgnoresCase release];
+    replaceIgnoresCase = nil;
+    [replaceUsesRegularExpressions release];
+    replaceUsesRegularExpressions = nil;
+    [replaceSearch release];
+    replaceSearch = nil;
+}
+
+/***** What are we looking for? *****/
+
+/*
+ * The find panel keeps what you're looking for on the find
+ * pasteboard, so we look there first.  Ignore Case and Regular
+ * Expression are whatever they were last set to in the Replace All
+ * sheet, except that on Mac OS X 10.5 Leopard and up, the find
+ * panel puts its own Ignore Case setting on the pasteboard too, and
+ * that wins.  Returns nil if there's nothing to look for (or it's a
+ * bad regular expression).
+ */
+
+- (CPTextSearch *)findPanelSearch
+{
+    NSPasteboard *findPasteboard = [NSPasteboard pasteboardWithName:NSFindPboard];
+    NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+    NSString *pattern = [findPasteboard stringForType:NSStringPboardType];
+    BOOL ignoresCase = [defaults boolForKey:CP_FindIgnoresCase];
+    unsigned options = 0;
+    
+    if ([[findPasteboard types] containsObject:@"NSFindPanelSearchOptionsPboardType"])
+    {
+        NSNumber *panelIgnoresCase = [[findPasteboard propertyListForType:@"NSFindPanelSearchOptionsPboardType"] objectForKey:@"NSFindPanelCaseInsensitiveSearch"];
+        
+        if (panelIgnoresCase != nil)
+            ignoresCase = [panelIgnoresCase boolValue];
+    }
+    
+    if ([pattern length] == 0)
+        pattern = [self selectedText];
+    
+    if ([pattern length] == 0)
+        return nil;
+    
+    if (ignoresCase)
+        options |= CPSearchCaseInsensitive;
+    
+    if ([defaults boolForKey:CP_FindUsesRegularExpressions] && [CPTextSearch supportsRegularExpressions])
+        options |= CPSearchRegularExpression;
+    
+    return [[[CPTextSearch alloc] initWithPattern:pattern options:options] autorelease];
+}
+
 /***** Bigger *****/
 
 - (void)bigger
@@ -1040,144 +1508,109 @@
 
 - (NSFileWrapper *)fileWrapperRepresentationOfType:(NSString *)aType
 {
-    NSUndoManager *undoManager = [self undoManager];  // This will be explained later
+    CPDocumentFormat format = [MyDocument formatForType:aType];
+    NSFileWrapper *fileWrapper;
+    
+    // We can only save Word files on Panther or later
+    
+    if (format == CPFormatWord && !supportsWordFormat)
+        return nil;
     
-    // Save a CocoaPad document
+    /*
+     * CPDocumentCodec doesn't change the text storage (RTF, Word, and
+     * plain text get their graphics stripped from a copy), so usually
+     * we don't have to clear the undo history or update the text view
+     * like we used to.  But if there are pictures in the window that
+     * the file can't keep, they have to go from the window too --
+     * otherwise the document would look saved, and they'd just be
+     * gone the next time it's opened.
+     */
     
-    if ([aType isEqualToString:CP_CPDocument])
+    if ((format == CPFormatRTF || format == CPFormatWord || format == CPFormatText) && [textStorage containsAttachments])
     {
-        [fileContents release];  // Get rid of the old fileContents
-        fileContents = [[textStorage RTFDFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];  // Get the RTFD data
-        
-        // Update the format flags
-        
-        plainText = NO;
-        cpd = YES;
-        rtf = NO;
-        rtfd = NO;
-        doc = NO;
-        
-        converted = NO;
-        
-        // We have to bite the bullet and follow what TextEdit does here, since
-        // the undo manager simply refuses to register any more actions after
-        // saving otherwise...
-        
-        [undoManager removeAllActions];
-        
-        return [[[NSFileWrapper alloc] initRegularFileWithContents:fileContents] autorelease];
+        [self removeAttachments];
+        [[self undoManager] removeAllActions];  // The old edits don't line up with the text anymore
     }
     
-    // Save a Rich Text Format document
+    // If it's still being encoded in the background, and the text hasn't
+    // changed since, wait for that instead of starting all over again.
+    // But if it hasn't even started (other documents' encodings are
+    // ahead of it), waiting could take ages, so we do it ourselves.
     
-    else if ([aType isEqualToString:CP_RTFDocument])
+    if (exportTask != nil && [[[exportTask object] objectForKey:@"Generation"] unsignedLongValue] == changeGeneration &&
+        [[[exportTask object] objectForKey:@"Format"] intValue] == format)
     {
-        [self removeAttachments];  // Strip the document of all offending graphics and such
-        
-        [fileContents release];  // Get rid of the old fileContents
-        fileContents = [[textStorage RTFFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];  // Get the RTF data
-        
-        // Update the format flags
-        
-        plainText = NO;
-        cpd = NO;
-        rtf = YES;
-        rtfd = NO;
-        doc = NO;
-        
-        converted = NO;
-        
-        // We have to bite the bullet and follow what TextEdit does here, since
-        // the undo manager simply refuses to register any more actions after
-        // saving otherwise...
-        
-        [undoManager removeAllActions];
+        if ([[CPWorkerPool sharedPool] removeTask:exportTask])
+        {
+            [exportTask release];
+            exportTask = nil;
+            
+            [self hideExportSheet];
+        }
         
-        return [[[NSFileWrapper alloc] initRegularFileWithContents:fileContents] autorelease];
+        else
+        {
+            [exportTask waitUntilFinished];
+            [self exportDidFinish:exportTask];  // The main thread would have told us later
+        }
     }
     
-    // Save an RTFD document
+    // If the text hasn't changed since it was encoded in the background
+    // (after a conversion), we can use that instead of doing it again
     
-    else if ([aType isEqualToString:CP_RTFDDocument])
+    if (exportWrapper != nil && exportFormat == format)
     {
-        [fileContents release];  // Get rid of the old fileContents
-        fileContents = [[textStorage RTFDFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];  // Get the RTFD data
-        
-        // Update the format flags
-        
-        plainText = NO;
-        cpd = NO;
-        rtf = NO;
-        rtfd = YES;
-        doc = NO;
-        
-        converted = NO;
-        
-        // We have to bite the bullet and follow what TextEdit does here, since
-        // the undo manager simply refuses to register any more actions after
-        // saving otherwise...
-        
-        [undoManager removeAllActions];
-        
-        return [textStorage RTFDFileWrapperFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil];
+        fileWrapper = [[exportWrapper retain] autorelease];
+    }
+    
+    else
+    {
+        fileWrapper = [CPDocumentCodec fileWrapperFromText:textStorage format:format];
     }
     
-    // Save a Word document
+    if (fileWrapper == nil)
+        return nil;  // Otherwise, the document could not be saved
+    
+    // Update the format flags
+    
+    [self setType:aType];
+    converted = NO;
     
-    else if ([aType isEqualToString:CP_WordDocument] && supportsWordFormat)
+    return fileWrapper;
+}
+
+/***** Save a plain text file a piece at a time *****/
+
+/*
+ * If the text is in a CPPieceTableStorage, it writes its pieces
+ * straight to the file, so we never have to make the whole
+ * document into one big string (and then one big UTF-8 copy of
+ * it).  Everything else goes through fileWrapperRepresentationOfType:.
+ */
+
+- (BOOL)writeToFile:(NSString *)fileName ofType:(NSString *)docType
+{
+    if ([MyDocument formatForType:docType] == CPFormatText && [textStorage isKindOfClass:[CPPieceTableStorage class]])
     {
-        [self removeAttachments];  // Strip the document of all offending graphics and such
+        NSDate *start = [NSDate date];
         
-        [fileContents release];  // Get rid of the old fileContents
-        fileContents = [[textStorage docFormatFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];  // Get the Word data
+        if (![(CPPieceTableStorage *)textStorage writeToFile:fileName encoding:NSUTF8StringEncoding])  // We use Unicode UTF-8
+            return NO;
         
-        // Update the format flags
+        if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+        {
+            NSLog(@"Saved %u characters (%u pieces) in %.3f sec", [textStorage length], [(CPPieceTableStorage *)textStorage pieceCount], -[start timeIntervalSinceNow]);
+        }
         
-        plainText = NO;
-        cpd = NO;
-        rtf = NO;
-        rtfd = NO;
-        doc = YES;
+        // Update the format flags
         
+        [self setType:docType];
         converted = NO;
         
-        // We have to bite the bullet and follow what TextEdit does here, since
-        // the undo manager simply refuses to register any more actions after
-        // saving otherwise...
-        
-        [undoManager removeAllActions];
-        
-        return [[[NSFileWrapper alloc] initRegularFileWithContents:fileContents] autorelease];
+        return YES;
     }
-       
-    // Save a plain text document
     
-    else if ([aType isEqualToString:CP_TextDocument])
-    {
-        // Update the format flags
-        
-        plainText = YES;
-        cpd = NO;
-        rtf = NO;
-        rtfd = NO;
-        doc = NO;
-        
-        converted = NO;
-        
-        // We have to bite the bullet and follow what TextEdit does here, since
-        // the undo manager simply refuses to register any more actions after
-        // saving otherwise...
-        
-        [undoManager removeAllActions];
-        
-        [self removeAttachments];  // Strip the document of all offending graphics and such
-        [self updateView];  // Now update the text view
-        
-        // We use Unicode UTF-8
-        return [[[NSFileWrapper alloc] initRegularFileWithContents:[string dataUsingEncoding:NSUTF8StringEncoding]] autorelease];
-    }
-    
-    return nil;  // Otherwise, the document could not be saved
+    return [super writeToFile:fileName ofType:docType];
 }
 
 /***** Load the data from the file provided into a document *****/
@@ -1197,8 +1630,8 @@
         
         if ([docType isEqualToString:CP_CPDocument])
         {
-            // Read the data from the file
-            NSData *data = [[NSData alloc] initWithContentsOfFile:fileName];
+            // Map the file (it's let go as soon as it's loaded)
+            NSData *data = [[NSData alloc] initWithContentsOfMappedFile:fileName];
             
             fileContents = [data retain];  // This is shorter version of "Retain, then Release"
             [self setFileType:docType];  // Set the file type
@@ -1247,15 +1680,12 @@
         
         else if ([docType isEqualToString:CP_RTFDDocument])
         {
-            // Read the data from the file (wrapper)
-            NSFileWrapper *wrapper = [[NSFileWrapper alloc] initWithPath:fileName];
-            
-            // Get the data from the RTFD document
-            NSAttributedString *tempString = [[NSAttributedString alloc] initWithRTFDFileWrapper:wrapper documentAttributes:nil];
+            // Read the file wrapper -- it gets decoded in loadDocument.
+            // The pictures are memory mapped, so they aren't read yet.
             
-            // This is shorter version of "Retain, then Release"
-            fileContents = [[tempString RTFDFromRange:NSMakeRange(0, [tempString length]) documentAttributes:nil] retain];
+            NSFileWrapper *wrapper = [CPDocumentCodec fileWrapperWithContentsOfPath:fileName];
             
+            fileWrapper = [wrapper retain];
             [self setFileType:docType];  // Set the file type
             
             // Update the format flags
@@ -1268,9 +1698,6 @@
             
             converted = NO;
             
-            [tempString release];  // We're done with the temporary string
-            [wrapper release];  // We're done with our file wrapper
-            
             return YES;
         }
         
@@ -1322,34 +1749,7 @@
         
         else
         {
-            NSString *plainTextString = [[NSString alloc] initWithContentsOfFile:fileName];
-            
-            if (plainTextString == nil)
-            {
-                // This will give more information than Cocoa's generic "Can't open file 'xxx.xxx'." alert.
-                // It will run an alert panel, and then let Apple let us know it couldn't be opened.
-                
-                NSRunAlertPanel(L_OPEN_FAILED_SHEET_TITLE, L_OPEN_FAILED_SHEET_DESCRIPTION, L_OK_BUTTON, @"", nil);
-                
-                return NO;
-            }
-            
-            // Update the format flags
-            
-            plainText = YES;
-            cpd = NO;
-            rtf = NO;
-            rtfd = NO;
-            doc = NO;
-            
-            converted = NO;
-            
-            // Update everything
-            
-            [self setString:plainTextString];  // The string is now the loaded data, and retained by us
-            [plainTextString release];  // The string did its job -- we don't need it anymore
-            
-            return YES;
+            return [self readPlainTextFromFile:fileName];
         }
     }
     
@@ -1357,36 +1757,54 @@
     
     else
     {
-        NSString *plainTextString = [[NSString alloc] initWithContentsOfFile:fileName];
-        
-        if (plainTextString == nil)
-        {
-            // This will give more information than Cocoa's generic "Can't open file 'xxx.xxx'." alert.
-            // It will run an alert panel, and then let Apple let us know it couldn't be opened.
-            
-            NSRunAlertPanel(L_OPEN_FAILED_SHEET_TITLE, L_OPEN_FAILED_SHEET_DESCRIPTION, L_OK_BUTTON, @"", nil);
-            
-            return NO;
-        }
-        
-        // Update the format flags
-        
-        plainText = YES;
-        cpd = NO;
-        rtf = NO;
-        rtfd = NO;
-        doc = NO;
-        
-        converted = NO;
-        
-        // Update everything
+        return [self readPlainTextFromFile:fileName];
+    }
+    
+    return YES;
+}
+
+/***** Get a plain text file ready to load *****/
+
+/*
+ * We don't read the whole file into a string here anymore.  The
+ * file is memory mapped, and loadDocument hands it to a
+ * CPPieceTableStorage, which reads the text right out of it.
+ * That way we never have more than one copy of the text in
+ * memory, even for multi-hundred-megabyte log files.
+ */
+
+- (BOOL)readPlainTextFromFile:(NSString *)fileName
+{
+    NSData *data = [[NSData alloc] initWithContentsOfMappedFile:fileName];
+    
+    if (data == nil)
+    {
+        // This will give more information than Cocoa's generic "Can't open file 'xxx.xxx'." alert.
+        // It will run an alert panel, and then let Apple let us know it couldn't be opened.
         
-        [self setString:plainTextString];  // The string is now the loaded data, and retained by us
-        [plainTextString release];  // The string did its job -- we don't need it anymore
+        NSRunAlertPanel(L_OPEN_FAILED_SHEET_TITLE, L_OPEN_FAILED_SHEET_DESCRIPTION, L_OK_BUTTON, @"", nil);
         
-        return YES;
+        return NO;
     }
     
+    // Update the format flags
+    
+    plainText = YES;
+    cpd = NO;
+    rtf = NO;
+    rtfd = NO;
+    doc = NO;
+    
+    converted = NO;
+    
+    // Figure out the encoding now, so we can decode it in pieces later
+    
+    [textData release];
+    textData = data;  // Already retained by alloc
+    textEncoding = [CPDocumentCodec encodingOfTextData:textData headerLength:&textLocation];
+    
+    [self setString:nil];  // We'll get the string from the text view once it's loaded
+    
     return YES;
 }
 
@@ -1401,7 +1819,7 @@
 
 - (void)loadDocument
 {
-    NSRange documentLength = NSMakeRange(0, [[textView string] length]);  // The document length
+    NSDate *start = [NSDate date];
     
     //
     // Set the file type and load the document
@@ -1409,106 +1827,43 @@
     
     if (cpd)
     {
-        // Load the document with RTFD (CPD) data (if it's not nil)
-        
-        if (fileContents != nil)
-        {
-            NSAttributedString *docString = [[NSAttributedString alloc] initWithRTFD:fileContents documentAttributes:nil];
-            
-            // If we don't check, new documents will give an "Unable to
-            // read RTFD from data:0x0" when we update the text view...
-            
-            [textView replaceCharactersInRange:documentLength withRTFD:fileContents];
-            
-            [docString release];
-        }
-        
-        else
-        {
-            [textView setTypingAttributes:[self defaultTextAttributes]];
-        }
-        
+        [self loadRichTextOfFormat:CPFormatCPD];
         [self setFileType:CP_CPDocument];  // Set the file type
     }
     
     else if (rtf)
     {
-        // Load the document with RTF data (if it's not nil)
-        
-        if (fileContents != nil)
-        {
-            NSAttributedString *docString = [[NSAttributedString alloc] initWithRTF:fileContents documentAttributes:nil];
-            
-            // Although RTF and Word data don't complain like RTFD does,
-            // it doesn't hurt to check if the data is nil, right?
-            
-            [textView replaceCharactersInRange:documentLength withRTF:fileContents];
-            
-            [docString release];
-        }
-        
-        else
-        {
-            [textView setTypingAttributes:[self defaultTextAttributes]];
-        }
-        
+        [self loadRichTextOfFormat:CPFormatRTF];
         [self setFileType:CP_RTFDocument];  // Set the file type
     }
     
     else if (rtfd)
     {
-        // Load the document with RTFD data (if it's not nil)
-        
-        if (fileContents != nil)
-        {
-            NSAttributedString *docString = [[NSAttributedString alloc] initWithRTFD:fileContents documentAttributes:nil];
-            
-            // If we don't check, new documents will give an "Unable to
-            // read RTFD from data:0x0" when we update the text view...
-            
-            [textView replaceCharactersInRange:documentLength withRTFD:fileContents];                
-            
-            [docString release];
-        }
-        
-        else
-        {
-            [textView setTypingAttributes:[self defaultTextAttributes]];
-        }
-        
+        [self loadRichTextOfFormat:CPFormatRTFD];
         [self setFileType:CP_RTFDDocument];  // Set the file type
     }
     
     else if (doc)
     {
-        // Load the Word data (my code was buggy as hell, so I just copied
-        // Ali Ozer's code from TextEdit... heh heh).
+        [self loadRichTextOfFormat:CPFormatWord];
+        [self setFileType:CP_WordDocument];  // Set the file type
+    }
+    
+    else if (textData != nil)
+    {
+        // The piece table reads right out of the file, so there's
+        // nothing to copy -- it just takes the text view's place
         
-        if (fileContents != nil)
-        {
-            NSLayoutManager *layoutManager = [textView layoutManager];
-            NSURL *url = [NSURL fileURLWithPath:[self fileName]];
-            NSMutableDictionary *options = [NSMutableDictionary dictionary];
-            
-            // Temporarily remove layout manager so it doesn't do any work while loading
-            [layoutManager retain];
-            [textStorage removeLayoutManager:layoutManager];
-            
-            [textStorage beginEditing];
-            [textStorage readFromURL:url options:options documentAttributes:nil];  // Read!
-            [textStorage endEditing];
-            
-            // Hook layout manager back up
-            [textStorage addLayoutManager:layoutManager];
-            [layoutManager release];
-        }
+        CPPieceTableStorage *storage = [[CPPieceTableStorage alloc] initWithData:textData encoding:textEncoding headerLength:textLocation attributes:[self defaultTextAttributes]];
         
-        else
-        {
-            [textView setTypingAttributes:[self defaultTextAttributes]];
-        }
+        [storage setDelegate:self];
+        [[textView layoutManager] replaceTextStorage:storage];
+        textStorage = storage;  // Already retained by alloc (and released in dealloc)
         
-        [self setFileType:CP_WordDocument];  // Set the file type
+        // It holds on to the file if it needs it
+        
+        [textData release];
+        textData = nil;
     }
     
     else
@@ -1517,6 +1872,281 @@
     }
     
     [textView moveToBeginningOfDocument:nil];  // Move the cursor the top of the document
+    
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+    {
+        NSLog(@"Loaded %@ document (%u characters) in %.3f sec", [CPDocumentCodec pathExtensionForFormat:[self format]], [textStorage length], -[start timeIntervalSinceNow]);
+    }
+}
+
+/***** Show that the encoding is still going *****/
+
+/*
+ * Most documents are encoded before this gets called.  Big ones
+ * get a sheet with a progress bar.  While it's up, the text can't
+ * change, so the encoding won't go to waste.  Cancel gets rid of
+ * it right away -- the document is encoded when it's saved instead.
+ */
+
+- (void)showExportSheet
+{
+    NSView *content;
+    NSTextField *label;
+    NSButton *cancelButton;
+    
+    if (exportTask == nil || exportSheet != nil || [self currentWindow] == nil)
+        return;
+    
+    exportSheet = [[NSPanel alloc] initWithContentRect:NSMakeRect(0, 0, 360, 108) styleMask:NSTitledWindowMask backing:NSBackingStoreBuffered defer:YES];
+    [exportSheet setReleasedWhenClosed:NO];  // We release it ourselves
+    content = [exportSheet contentView];
+    
+    label = [[[NSTextField alloc] initWithFrame:NSMakeRect(20, 72, 320, 17)] autorelease];
+    [label setStringValue:[NSString stringWithFormat:L_EXPORTING_TEXT, [[CPDocumentCodec pathExtensionForFormat:[self format]] uppercaseString]]];
+    [label setEditable:NO];
+    [label setSelectable:NO];
+    [label setBezeled:NO];
+    [label setDrawsBackground:NO];
+    [content addSubview:label];
+    
+    exportProgress = [[NSProgressIndicator alloc] initWithFrame:NSMakeRect(20, 48, 320, 16)];
+    [exportProgress setIndeterminate:YES];
+    [content addSubview:exportProgress];
+    
+    cancelButton = [[[NSButton alloc] initWithFrame:NSMakeRect(250, 12, 96, 32)] autorelease];
+    [cancelButton setBezelStyle:NSRoundedBezelStyle];
+    [cancelButton setTitle:L_CANCEL_BUTTON];
+    [cancelButton setKeyEquivalent:@"\033"];  // Escape
+    [cancelButton setTarget:self];
+    [cancelButton setAction:@selector(cancelExport:)];
+    [content addSubview:cancelButton];
+    
+    [NSApp beginSheet:exportSheet modalForWindow:[self currentWindow] modalDelegate:nil didEndSelector:NULL contextInfo:NULL];
+    [exportProgress startAnimation:nil];
+}
+
+/***** Take the progress sheet down (or don't bother putting it up) *****/
+
+- (void)hideExportSheet
+{
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(showExportSheet) object:nil];
+    
+    if (exportSheet == nil)
+        return;
+    
+    [exportProgress stopAnimation:nil];
+    [NSApp endSheet:exportSheet];
+    [exportSheet orderOut:nil];
+    
+    [exportSheet release];
+    exportSheet = nil;
+    [exportProgress release];
+    exportProgress = nil;
+}
+
+/***** Encode the text in the background *****/
+
+/*
+ * After a conversion, we take a snapshot of the text and encode it
+ * on the worker pool, so it's ready when the document is saved.
+ * If more than one document is converted at a time, they're done
+ * in parallel.  If the text changes before it's done (or before
+ * it's saved), the result just gets thrown out, and saving encodes
+ * it the old-fashioned way.
+ */
+
+- (void)startExport
+{
+    CPDocumentFormat format = [self format];
+    NSDictionary *job;
+    
+    // Forget about the last one
+    
+    [self hideExportSheet];
+    [exportTask cancel];
+    [exportTask release];
+    exportTask = nil;
+    
+    [exportWrapper release];
+    exportWrapper = nil;
+    
+    if (format == CPFormatWord && !supportsWordFormat)
+        return;  // We can't save it anyway
+    
+    job = [NSDictionary dictionaryWithObjectsAndKeys:
+        [self textSnapshot], @"Text",
+        [NSNumber numberWithInt:format], @"Format",
+        [NSNumber numberWithUnsignedLong:changeGeneration], @"Generation",
+        nil];
+    
+    // The task doesn't hold on to us (the class does the work, and we're
+    // only its delegate), so if the document is closed while it's
+    // running, it still goes away on the main thread
+    
+    exportTask = [[[CPWorkerPool sharedPool] addTaskWithTarget:[MyDocument class] selector:@selector(encodeExport:) object:job delegate:self didFinishSelector:@selector(exportDidFinish:)] retain];
+    
+    [self performSelector:@selector(showExportSheet) withObject:nil afterDelay:CP_ExportSheetDelay];
+}
+
+/***** Is there an encoding still running? *****/
+
+- (BOOL)isExporting
+{
+    return (exportTask != nil);
+}
+
+/***** Stop the encoding (from the progress sheet) *****/
+
+// The document stays converted; it just gets encoded when it's saved
+
+- (void)cancelExport:(id)sender
+{
+    [exportTask cancel];
+    [exportTask release];
+    exportTask = nil;
+    
+    [self hideExportSheet];
+}
+
+/***** Do the encoding (on a worker thread) *****/
+
+// This only looks at the job, never at a document
+
++ (id)encodeExport:(NSDictionary *)job
+{
+    return [CPDocumentCodec fileWrapperFromText:[job objectForKey:@"Text"] format:[[job objectForKey:@"Format"] intValue]];
+}
+
+/***** The encoding's done (back on the main thread) *****/
+
+- (void)exportDidFinish:(CPWorkerTask *)task
+{
+    NSDictionary *job = [task object];
+    
+    if (task != exportTask)
+        return;  // There's a newer one
+    
+    // Only keep it if the text and format haven't changed in the meantime
+    
+    if ([task result] != nil && [[job objectForKey:@"Generation"] unsignedLongValue] == changeGeneration && [[job objectForKey:@"Format"] intValue] == [self format])
+    {
+        exportWrapper = [[task result] retain];
+        exportFormat = [self format];
+    }
+    
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+    {
+        NSLog(@"Encoded %@ in the background in %.3f sec (%@; %u task(s) still pending)", [CPDocumentCodec pathExtensionForFormat:[[job objectForKey:@"Format"] intValue]], [task runTime], (exportWrapper != nil) ? @"kept" : @"out of date", [[CPWorkerPool sharedPool] pendingCount]);
+    }
+    
+    [exportTask cancel];  // If saving got here first, the main thread's notice is still on its way (and we might be closed by then)
+    [exportTask release];
+    exportTask = nil;
+    
+    [self hideExportSheet];
+}
+
+/***** Load a rich text document *****/
+
+/*
+ * The file is decoded exactly once, by CPDocumentCodec, and goes
+ * straight into the text storage while the layout manager is off.
+ * We used to parse it into a string we never used, and then parse
+ * it again through the text view (and RTFD packages got converted
+ * to RTFD data and back first).  Once it's in, we don't need the
+ * file anymore, so we let go of it.
+ *
+ * Before it goes in, the attachment cache takes over the pictures,
+ * so they aren't decoded until they're drawn.
+ */
+
+- (void)loadRichTextOfFormat:(CPDocumentFormat)format
+{
+    NSAttributedString *text = nil;
+    
+    // If we don't check, new documents will give an "Unable to
+    // read RTFD from data:0x0" when we update the text view...
+    
+    if (fileWrapper != nil)
+    {
+        text = [CPDocumentCodec textFromFileWrapper:fileWrapper format:format];
+    }
+    
+    else if (fileContents != nil)
+    {
+        text = [CPDocumentCodec textFromData:fileContents format:format];
+    }
+    
+    if (text != nil)
+    {
+        if ([text containsAttachments])
+        {
+            unsigned count = [[self attachmentCache] adoptAttachmentsInText:text];
+            
+            if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+            {
+                NSLog(@"Loading %u picture(s) (%lu bytes) only when they're drawn", count, [attachmentCache fileBytes]);
+            }
+        }
+        
+        [self beginLoading];
+        [textStorage setAttributedString:text];
+        [self endLoading];
+    }
+    
+    else
+    {
+        [textView setTypingAttributes:[self defaultTextAttributes]];
+    }
+    
+    // We're done with the file
+    
+    [fileContents release];
+    fileContents = nil;
+    
+    [fileWrapper release];
+    fileWrapper = nil;
+}
+
+/***** Take the layout manager off while we fill the text storage *****/
+
+/*
+ * This is Ali Ozer's trick from TextEdit (it used to be only in the
+ * Word loading code).  The layout manager doesn't do any work while
+ * it's off, so nothing gets laid out until we're completely done.
+ */
+
+- (void)beginLoading
+{
+    NSLayoutManager *layoutManager = [textView layoutManager];
+    
+    // Temporarily remove layout manager so it doesn't do any work while loading
+    [layoutManager retain];
+    [textStorage removeLayoutManager:layoutManager];
+    detachedLayoutManager = layoutManager;
+    
+    [textStorage beginEditing];
+}
+
+/***** Put the layout manager back on *****/
+
+- (void)endLoading
+{
+    [textStorage endEditing];
+    
+    // Hook layout manager back up
+    [textStorage addLayoutManager:detachedLayoutManager];
+    [detachedLayoutManager release];
+    detachedLayoutManager = nil;
+}
+
+/***** Remember that the document changed, so Automatic Backup picks it up *****/
+
+- (void)updateChangeCount:(NSDocumentChangeType)change
+{
+    needsBackup = YES;
+    
+    [super updateChangeCount:change];
 }
 
 /***** Print the document *****/
@@ -1556,130 +2186,346 @@
 //
 
 /*
- * In all of the text utilities, an attributed string containing a
- * "snapshot" of the old text is passed.  This snapshot is taken
- * whenever we register with the undo manager (by copying the text
- * storage object).  Most of the time, this string is nil, and we
- * just do a regular uppercase/lowercase/capitalize.  If the string
- * is set, though, it's basically saying "Undo", so instead of doing
- * regular stuff, we replace the current text with the snapshot we took.
+ * Uppercase, lowercase, and capitalize all go through
+ * changeCaseOfSelection:.  The sender is ignored (it's either nil,
+ * from InterfaceController, or the toolbar item).
  */
 
 /***** Uppercase *****/
 
-- (void)uppercase:(NSAttributedString *)attributedString
+- (void)uppercase:(id)sender
 {
-    NSString *document;
-    NSRange selectedRange;
-    NSUndoManager *undoManager = [self undoManager];
-    
-    if ([self selectedText] == nil)
-        selectedRange = NSMakeRange(0, [[textView string] length]);
-    
-    else
-        selectedRange = [textView selectedRange];
+    [self changeCaseOfSelection:CPUppercase];
+}
+
+/***** Lowercase *****/
+
+- (void)lowercase:(id)sender
+{
+    [self changeCaseOfSelection:CPLowercase];
+}
+
+/***** Capitalize *****/
+
+- (void)capitalize:(id)sender
+{
+    [self changeCaseOfSelection:CPCapitalize];
+}
+
+/***** Does a character end a word (for capitalizing)? *****/
+
+// Only spaces and line breaks do -- not apostrophes or other punctuation
+
+static BOOL CPBreaksWord(unichar c)
+{
+    if (c < 0x80)
+        return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
     
-    // Register with undo manager
+    return [[NSCharacterSet whitespaceAndNewlineCharacterSet] characterIsMember:c];
+}
+
+/***** Change the case of a run of characters *****/
+
+/*
+ * Plain ASCII (which is most text) is done right in the buffer.
+ * Anything else goes through NSString, which knows about things
+ * like the German sharp s turning into "SS".  atWordStart says
+ * whether the run starts a new word (for capitalizing), and is
+ * updated for the next run.  Both ways use CPBreaksWord to find
+ * the words, so "don't" comes out "Don't" either way (NSString's
+ * capitalizedString would make it "Don'T").  Returns nil if
+ * nothing changed.
+ */
+
+static NSString *CPChangeCase(NSString *run, CPCaseChange caseChange, BOOL *atWordStart)
+{
+    unsigned length = [run length];
+    unichar *characters = malloc(length * sizeof(unichar));
+    NSString *result = nil;
+    BOOL ascii = YES;
+    BOOL changed = NO;
+    unsigned i;
     
-    [undoManager registerUndoWithTarget:self selector:@selector(uppercase:) object:[textStorage copy]];
-    [undoManager setActionName:L_UNDO_UPPERCASE_ITEM_TITLE];
+    [run getCharacters:characters];
     
-    [textStorage beginEditing];  // We're gonna edit the text
+    for (i = 0; i < length && ascii; i++)
+        ascii = (characters[i] < 0x80);
     
-    if (attributedString == nil || [attributedString isKindOfClass:[NSToolbarItem class]])
+    if (ascii)
     {
-        // This replaces the text without harming the text's formatting
+        for (i = 0; i < length; i++)
+        {
+            unichar c = characters[i];
+            BOOL upper = (caseChange == CPUppercase || (caseChange == CPCapitalize && *atWordStart));
+            
+            if (upper && c >= 'a' && c <= 'z')
+            {
+                characters[i] = c - ('a' - 'A');
+                changed = YES;
+            }
+            
+            else if (!upper && c >= 'A' && c <= 'Z')
+            {
+                characters[i] = c + ('a' - 'A');
+                changed = YES;
+            }
+            
+            *atWordStart = CPBreaksWord(c);
+        }
         
-        document = [[[textView string] substringWithRange:selectedRange] uppercaseString];
-        [textStorage replaceCharactersInRange:selectedRange withString:document];
+        if (changed)
+            result = [NSString stringWithCharacters:characters length:length];
     }
     
     else
     {
-        [textStorage setAttributedString:attributedString];  // Undo the action
+        if (caseChange == CPUppercase)
+            result = [run uppercaseString];
+        
+        else if (caseChange == CPLowercase)
+            result = [run lowercaseString];
+        
+        else
+        {
+            NSMutableString *capitalized = [NSMutableString stringWithCapacity:length];
+            
+            i = 0;
+            
+            while (i < length)
+            {
+                if (CPBreaksWord(characters[i]))
+                {
+                    [capitalized appendString:[run substringWithRange:NSMakeRange(i, 1)]];
+                    *atWordStart = YES;
+                    i++;
+                }
+                
+                else if (*atWordStart)
+                {
+                    // The first letter (with any accents stuck on it)
+                    
+                    NSRange first = [run rangeOfComposedCharacterSequenceAtIndex:i];
+                    
+                    [capitalized appendString:[[run substringWithRange:first] capitalizedString]];
+                    *atWordStart = NO;
+                    i = NSMaxRange(first);
+                }
+                
+                else
+                {
+                    // The rest of the word
+                    
+                    unsigned end = i;
+                    
+                    while (end < length && !CPBreaksWord(characters[end]))
+                        end++;
+                    
+                    [capitalized appendString:[[run substringWithRange:NSMakeRange(i, end - i)] lowercaseString]];
+                    i = end;
+                }
+            }
+            
+            result = capitalized;
+        }
+        
+        *atWordStart = CPBreaksWord(characters[length - 1]);
+        
+        if ([result isEqualToString:run])
+            result = nil;
     }
     
-    [textStorage endEditing];  // Okay, we're done
+    free(characters);
     
-    [self updateView];  // Update the text view
+    return result;
 }
 
-/***** Lowercase *****/
+/***** Change the case of the selection (or the whole document) *****/
+
+/*
+ * We used to change the whole selection with one string, which gave
+ * all of it the formatting of the first character, and registered
+ * undo with a copy of the entire document (which was never
+ * released).  Now each attribute run is changed on its own, right
+ * in the text storage, so the formatting stays put even when the
+ * length changes.  Undo only holds onto the original selection.
+ */
 
-- (void)lowercase:(NSAttributedString *)attributedString
+- (void)changeCaseOfSelection:(CPCaseChange)caseChange
 {
-    NSString *document;
-    NSRange selectedRange;
-    NSUndoManager *undoManager = [self undoManager];
+    NSRange range = [textView selectedRange];
+    NSAttributedString *original;
+    NSString *actionName;
+    unsigned location, end;
+    BOOL atWordStart = YES;  // The selection always starts a word
+    BOOL changed = NO;
     
-    if ([self selectedText] == nil)
-        selectedRange = NSMakeRange(0, [[textView string] length]);
+    if (range.length == 0)
+        range = NSMakeRange(0, [textStorage length]);
     
-    else
-        selectedRange = [textView selectedRange];
+    if (range.length == 0)
+        return;  // Nothing to do
     
-    // Register with undo manager
-    
-    [undoManager registerUndoWithTarget:self selector:@selector(lowercase:) object:[textStorage copy]];
-    [undoManager setActionName:L_UNDO_LOWERCASE_ITEM_TITLE];
+    original = [textStorage attributedSubstringFromRange:range];
+    location = range.location;
+    end = NSMaxRange(range);
     
     [textStorage beginEditing];  // We're gonna edit the text
     
-    if (attributedString == nil || [attributedString isKindOfClass:[NSToolbarItem class]])
+    while (location < end)
     {
-        // This replaces the text without harming the text's formatting
+        NSRange runRange;
+        NSString *newText;
+        
+        [textStorage attributesAtIndex:location longestEffectiveRange:&runRange inRange:NSMakeRange(location, end - location)];
+        
+        newText = CPChangeCase([[textStorage string] substringWithRange:runRange], caseChange, &atWordStart);
         
-        document = [[[textView string] substringWithRange:selectedRange] lowercaseString];
-        [textStorage replaceCharactersInRange:selectedRange withString:document];
+        if (newText != nil)
+        {
+            // The new text picks up the attributes of the run it replaces
+            
+            [textStorage replaceCharactersInRange:runRange withString:newText];
+            
+            end = end + [newText length] - runRange.length;
+            location += [newText length];
+            changed = YES;
+        }
+        
+        else
+        {
+            location = NSMaxRange(runRange);
+        }
     }
     
+    [textStorage endEditing];  // Okay, we're done
+    
+    if (!changed)
+        return;
+    
+    // Register with undo manager
+    
+    if (caseChange == CPUppercase)
+        actionName = L_UNDO_UPPERCASE_ITEM_TITLE;
+    
+    else if (caseChange == CPLowercase)
+        actionName = L_UNDO_LOWERCASE_ITEM_TITLE;
+    
     else
+        actionName = L_UNDO_CAPITALIZE_ITEM_TITLE;
+    
+    [[[self undoManager] prepareWithInvocationTarget:self] replaceTextInRange:NSMakeRange(range.location, end - range.location) withAttributedString:original actionName:actionName];
+    [[self undoManager] setActionName:actionName];
+    
+    [textView setSelectedRange:NSMakeRange(range.location, end - range.location)];
+    [self updateString];  // Update the plain text string
+}
+
+/***** Replace part of the text (and be able to undo it) *****/
+
+/*
+ * Undo and redo both come through here, and each registers the
+ * other.  Only the text being replaced is saved, not the whole
+ * document.
+ */
+
+- (void)replaceTextInRange:(NSRange)range withAttributedString:(NSAttributedString *)text actionName:(NSString *)actionName
+{
+    NSUndoManager *undoManager = [self undoManager];
+    NSRange newRange = NSMakeRange(range.location, [text length]);
+    
+    [[undoManager prepareWithInvocationTarget:self] replaceTextInRange:newRange withAttributedString:[textStorage attributedSubstringFromRange:range] actionName:actionName];
+    [undoManager setActionName:actionName];
+    
+    [textStorage replaceCharactersInRange:range withAttributedString:text];
+    
+    [textView setSelectedRange:newRange];
+    [self updateString];  // Update the plain text string
+}
+
+/***** Replace every match (and be able to undo it) *****/
+
+- (unsigned)replaceAll:(CPTextSearch *)search withString:(NSString *)replacement
+{
+    NSDate *start = [NSDate date];
+    NSData *ranges = [search rangesInString:[textStorage string]];
+    unsigned count = [ranges length] / sizeof(NSRange);
+    NSAttributedString *text;
+    NSData *lengths;
+    
+    if (count == 0)
+        return 0;
+    
+    text = [CPTextSearch replacementText:replacement forRanges:ranges inText:textStorage lengths:&lengths];
+    [self replaceTextInRanges:ranges withText:text lengths:lengths actionName:L_UNDO_REPLACE_ALL_ITEM_TITLE];
+    
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
     {
-        [textStorage setAttributedString:attributedString];  // Undo the action
+        NSLog(@"Replaced %u matches in %.3f sec", count, -[start timeIntervalSinceNow]);
     }
     
-    [textStorage endEditing];  // Okay, we're done
-    
-    [self updateView];  // Update the text view
+    return count;
 }
 
-/***** Capitalize *****/
+/***** Replace a lot of ranges at once (and be able to undo it) *****/
+
+/*
+ * Like replaceTextInRange:withAttributedString:actionName:, but
+ * for a lot of ranges at once -- they're all replaced in one edit
+ * (see CPTextSearch), and undone in one step.  Only the text being
+ * replaced is saved for undo.
+ */
 
-- (void)capitalize:(NSAttributedString *)attributedString
+- (void)replaceTextInRanges:(NSData *)ranges withText:(NSAttributedString *)text lengths:(NSData *)lengths actionName:(NSString *)actionName
 {
-    NSString *document;
-    NSRange selectedRange;
     NSUndoManager *undoManager = [self undoManager];
+    NSData *undoRanges, *undoLengths;
+    NSAttributedString *original;
     
-    if ([self selectedText] == nil)
-        selectedRange = NSMakeRange(0, [[textView string] length]);
+    if ([ranges length] == 0)
+        return;
     
-    else
-        selectedRange = [textView selectedRange];
+    original = [CPTextSearch replaceRanges:ranges inText:textStorage withText:text lengths:lengths undoRanges:&undoRanges undoLengths:&undoLengths];
     
-    // Register with undo manager
+    [[undoManager prepareWithInvocationTarget:self] replaceTextInRanges:undoRanges withText:original lengths:undoLengths actionName:actionName];
+    [undoManager setActionName:actionName];
     
-    [undoManager registerUndoWithTarget:self selector:@selector(capitalize:) object:[textStorage copy]];
-    [undoManager setActionName:L_UNDO_CAPITALIZE_ITEM_TITLE];
+    [textView setSelectedRange:*(const NSRange *)[undoRanges bytes]];  // The first replacement
+    [self updateString];  // Update the plain text string
+}
+
+/***** Select a lot of ranges *****/
+
+/*
+ * Text views can only select more than one range at a time on
+ * Mac OS X 10.4 Tiger and up, so otherwise we just select the
+ * first one.
+ */
+
+- (void)selectRanges:(NSData *)ranges
+{
+    const NSRange *list = [ranges bytes];
+    unsigned count = [ranges length] / sizeof(NSRange);
     
-    [textStorage beginEditing];  // We're gonna edit the text
+    if (count == 0)
+        return;
     
-    if (attributedString == nil || [attributedString isKindOfClass:[NSToolbarItem class]])
+    if ([textView respondsToSelector:@selector(setSelectedRanges:)])
     {
-        // This replaces the text without harming the text's formatting
+        NSMutableArray *values = [NSMutableArray arrayWithCapacity:count];
+        unsigned i;
+        
+        for (i = 0; i < count; i++)
+            [values addObject:[NSValue valueWithRange:list[i]]];
         
-        document = [[[textView string] substringWithRange:selectedRange] capitalizedString];
-        [textStorage replaceCharactersInRange:selectedRange withString:document];
+        [textView setSelectedRanges:values];
     }
     
     else
     {
-        [textStorage setAttributedString:attributedString];  // Undo the action
+        [textView setSelectedRange:list[0]];
     }
     
-    [textStorage endEditing];  // Okay, we're done
-    
-    [self updateView];  // Update the text view
+    [textView scrollRangeToVisible:list[0]];
 }
 
 /***** Change the document background color *****/
@@ -1695,7 +2541,7 @@
     if (documentTextColor == nil)
     {
         // Use the default color instead
-        documentTextColor = [NSUnarchiver unarchiveObjectWithData:[[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor]];
+        documentTextColor = [[CPPreferenceSnapshot currentSnapshot] textColor];
     }
     
     [textView setTextColor:documentTextColor];
@@ -1716,7 +2562,7 @@
     
     else
     {
-        [colorPanel setColor:[NSUnarchiver unarchiveObjectWithData:[[NSUserDefaults standardUserDefaults] objectForKey:CP_BackgroundColor]]];
+        [colorPanel setColor:[[CPPreferenceSnapshot currentSnapshot] backgroundColor]];
     }
     
     [colorPanel orderFront:self];  // Show the color panel
@@ -1762,15 +2608,12 @@
 
 - (void)convertToCPD
 {
-    NSData *textColorAsData;
-    
     if (plainText)
     {
         [textView setFont:[NSFont userFontOfSize:0.0]];  // Set the default font
         
         // Set the color to the what the prefs say
-        textColorAsData = [[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor];        
-        [textView setTextColor:[NSUnarchiver unarchiveObjectWithData:textColorAsData]];
+        [textView setTextColor:[[CPPreferenceSnapshot currentSnapshot] textColor]];
     }
     
     // Update the format flags
@@ -1783,25 +2626,20 @@
     
     converted = YES;
     
-    // Update fileContents
-    fileContents = [[textStorage RTFDFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];
-        
     [self updateView];  // Update the text view
+    [self startExport];  // Encode it in the new format in the background
 }
 
 /***** Convert to Rich Text Format *****/
 
 - (void)convertToRTF
 {
-    NSData *textColorAsData;
-    
     if (plainText)
     {
         [textView setFont:[NSFont userFontOfSize:0.0]];  // Set the default font
         
         // Set the text color to the what the preferences say
-        textColorAsData = [[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor];
-        [textView setTextColor:[NSUnarchiver unarchiveObjectWithData:textColorAsData]];
+        [textView setTextColor:[[CPPreferenceSnapshot currentSnapshot] textColor]];
     }
     
     // Update the format flags
@@ -1814,26 +2652,21 @@
     
     converted = YES;
     
-    // Update fileContents
-    fileContents = [[textStorage RTFFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];
-        
     [self removeAttachments];  // Get rid of all the graphics and stuff
     [self updateView];  // Update the text view
+    [self startExport];  // Encode it in the new format in the background
 }
 
 /***** Convert to RTFD format *****/
 
 - (void)convertToRTFD
 {
-    NSData *textColorAsData;
-    
     if (plainText)
     {
         [textView setFont:[NSFont userFontOfSize:0.0]];  // Set the default font
         
         // Set the color to the what the prefs say
-        textColorAsData = [[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor];        
-        [textView setTextColor:[NSUnarchiver unarchiveObjectWithData:textColorAsData]];
+        [textView setTextColor:[[CPPreferenceSnapshot currentSnapshot] textColor]];
     }
     
     // Update the format flags
@@ -1846,25 +2679,20 @@
     
     converted = YES;
     
-    // Update fileContents
-    fileContents = [[textStorage RTFDFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];
-        
     [self updateView];  // Update the text view
+    [self startExport];  // Encode it in the new format in the background
 }
 
 /***** Convert to Word format *****/
 
 - (void)convertToDocFormat
 {
-    NSData *textColorAsData;
-    
     if (plainText)
     {
         [textView setFont:[NSFont userFontOfSize:0.0]];  // Set the default font
         
         // Set the text color to the what the preferences say
-        textColorAsData = [[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor];
-        [textView setTextColor:[NSUnarchiver unarchiveObjectWithData:textColorAsData]];
+        [textView setTextColor:[[CPPreferenceSnapshot currentSnapshot] textColor]];
     }
     
     // Update the format flags
@@ -1877,11 +2705,9 @@
     
     converted = YES;
     
-    // Update fileContents
-    fileContents = [[textStorage docFormatFromRange:NSMakeRange(0, [[textView string] length]) documentAttributes:nil] retain];
-    
     [self removeAttachments];  // Get rid of all the graphics and stuff
     [self updateView];  // Update the text view
+    [self startExport];  // Encode it in the new format in the background
 }
 
 /***** Convert to plain text format *****/
@@ -1903,6 +2729,7 @@
     // Now update everything
         
     [self updateView];  // Update the text view
+    [self startExport];  // Encode it in the new format in the background
 }
 
 /***** Convert to plain text format (showing formatting warning sheet) *****/
@@ -1949,109 +2776,124 @@
 
 - (BOOL)containsFormatting
 {
-    int length = [textStorage length];
-    NSRange range;
-    NSDictionary *attributes;
-    
-    return (!plainText && (length > 0) && (attributes = [textStorage attributesAtIndex:0 effectiveRange:&range]) && ((attributes == nil) || (range.length < length) || ![[self defaultTextAttributes] isEqual:attributes]));
+    return (!plainText && ![self isPlainTextCompatible]);
 }
 
-/***** Get the default text attributes *****/
+/***** Would converting to plain text lose anything? *****/
 
 /*
- * This was originally written by Apple engineer
- * Ali Ozer for TextEdit.
+ * We go through the attribute runs, and stop at the first one
+ * with anything plain text can't keep.  Runs usually share the
+ * same attributes dictionary, so we only check each one once.
  */
 
-- (NSDictionary *)defaultTextAttributes
+- (BOOL)isPlainTextCompatible
 {
-    static NSParagraphStyle *defaultParagraphStyle = nil;
-    NSMutableDictionary *textAttributes = [[[NSMutableDictionary alloc] initWithCapacity:2] autorelease];
+    CPPreferenceSnapshot *prefs = [CPPreferenceSnapshot currentSnapshot];
+    NSDictionary *lastAttributes = nil;
+    unsigned location = 0;
+    unsigned length = [textStorage length];
     
-    if (defaultParagraphStyle == nil)
+    while (location < length)
     {
-        // We do this once...
+        NSRange range;
+        NSDictionary *attributes = [textStorage attributesAtIndex:location effectiveRange:&range];
         
-        int i;
-        NSString *measurementUnits = [[NSUserDefaults standardUserDefaults] objectForKey:@"AppleMeasurementUnits"];
-        float tabInterval = ([@"Centimeters" isEqual:measurementUnits]) ? (72.0 / 2.54) : (72.0 / 2.0);  // Every cm or half inch
-        NSMutableParagraphStyle *paragraphStyle = [[NSMutableParagraphStyle alloc] init];
-        
-        [paragraphStyle setTabStops:[NSArray array]];  // This first clears all tab stops
-        
-        for (i = 0; i < 16; i++)
+        if (attributes != lastAttributes)
         {
-            // Add 16 tab stops, at desired intervals...
+            if (![prefs attributesArePlain:attributes])
+                return NO;
             
-            NSTextTab *tabStop = [[NSTextTab alloc] initWithType:NSLeftTabStopType location:tabInterval * (i + 1)]; 
-            [paragraphStyle addTabStop:tabStop];
-            [tabStop release];
+            lastAttributes = attributes;
         }
         
-        defaultParagraphStyle = [paragraphStyle copy];
-        [paragraphStyle release];
+        location = NSMaxRange(range);
     }
     
-    // This step is necessary in order for the text view to actually work
-    [textAttributes setObject:(plainText) ? [NSFont userFixedPitchFontOfSize:0.0] : [NSFont userFontOfSize:0.0] forKey:NSFontAttributeName];
-    
-    // This step is necessary in order for the containsFormatting check to work
-    [textAttributes setObject:[NSUnarchiver unarchiveObjectWithData:[[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor]] forKey:NSForegroundColorAttributeName];
-    
-    // Assign our new paragraph style, containing the ruler (unless it's plain text)
-    [textAttributes setObject:(plainText) ? [NSParagraphStyle defaultParagraphStyle] : defaultParagraphStyle forKey:NSParagraphStyleAttributeName];
-    
-    return textAttributes;
+    return YES;
 }
 
-/***** Remove all attachments, graphics, etc. *****/
+/***** Get the default text attributes *****/
 
 /*
- * This was originally written by Apple engineer Ali Ozer for
- * TextEdit.  I cleaned it up a bit and changed the comments.
+ * This was originally written by Apple engineer Ali Ozer
+ * for TextEdit.  The attributes are built by the shared
+ * CPPreferenceSnapshot now, so we don't make a new dictionary
+ * (and unarchive the text color) every time.
  */
 
+- (NSDictionary *)defaultTextAttributes
+{
+    // These are cached until the preferences change
+    return [[CPPreferenceSnapshot currentSnapshot] defaultTextAttributesForPlainText:plainText];
+}
+
+/***** Remove all attachments, graphics, etc. *****/
+
 - (void)removeAttachments
 {
-    unsigned location = 0;
-    unsigned end = [textStorage length];
+    NSDate *start = [NSDate date];
+    unsigned bytes;
+    unsigned count = [CPDocumentCodec removeAttachmentsFromText:textStorage bytes:&bytes];
     
-    [textStorage beginEditing];  // We're gonna edit the text
-    
-    // Go through the document, looking for attachments
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+    {
+        NSLog(@"Removed %u attachment(s) (%u bytes) in %.3f sec", count, bytes, -[start timeIntervalSinceNow]);
+    }
+}
+
+/***** One document's part of the memory report *****/
+
+- (NSString *)memoryFootprint
+{
+    CPAttachmentCache *cache = [self attachmentCache];
+    float megabyte = 1024.0 * 1024.0;
+    
+    return [NSString stringWithFormat:L_MEMORY_REPORT_TEXT,
+        [self displayName],
+        [textStorage length], ([textStorage length] * sizeof(unichar)) / megabyte,
+        [cache loadedCount], [cache attachmentCount], [cache usedBytes] / megabyte, [cache memoryLimit] / megabyte,
+        [cache fileBytes] / megabyte];
+}
+
+/***** About how much memory is the document using? *****/
+
+/*
+ * The text (as if it were all one string) and the decoded
+ * pictures.  The picture files are memory mapped, so they
+ * don't count -- the system can always throw them out.
+ */
+
+- (unsigned long)memoryBytes
+{
+    return ([textStorage length] * sizeof(unichar)) + [attachmentCache usedBytes];
+}
+
+/***** Show the memory report *****/
+
+- (void)showMemoryReport
+{
+    NSArray *documents = [[NSDocumentController sharedDocumentController] documents];
+    NSMutableArray *lines = [NSMutableArray arrayWithCapacity:[documents count] + 1];
+    unsigned long total = 0;
+    unsigned i;
     
-    while (location < end)
+    for (i = 0; i < [documents count]; i++)
     {
-        NSRange attachmentRange;
-        NSTextAttachment *attachment = [textStorage attribute:NSAttachmentAttributeName atIndex:location longestEffectiveRange:&attachmentRange inRange:NSMakeRange(location, end - location)];
+        MyDocument *document = [documents objectAtIndex:i];
         
-        if (attachment != nil)
-        {
-            // Okay...I think we found something
-            
-            unichar currentCharacter = [[textStorage string] characterAtIndex:location];
-            
-            if (currentCharacter == NSAttachmentCharacter)
-            {
-                // Yes, it's an attachment -- let's get rid of it
-                
-                [textStorage replaceCharactersInRange:NSMakeRange(location, 1) withString:nil];
-                end = [textStorage length];
-            }
-            
-            else
-            {
-                location++;  // Keep going...
-            }
-        }
-        
-        else
-        {
-            location = NSMaxRange(attachmentRange);
-        }
+        [lines addObject:[document memoryFootprint]];
+        total += [document memoryBytes];
     }
     
-    [textStorage endEditing];  // Okay, we're done
+    [lines addObject:[NSString stringWithFormat:L_MEMORY_REPORT_TOTAL, total / (1024.0 * 1024.0), [documents count]]];
+    
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+    {
+        NSLog(@"%@", [lines componentsJoinedByString:@"\n"]);
+    }
+    
+    NSBeginInformationalAlertSheet(L_MEMORY_REPORT_TITLE, L_OK_BUTTON, nil, nil, [self currentWindow], self, nil, nil, nil, @"%@", [lines componentsJoinedByString:@"\n\n"]);
 }
 
 /********************/
@@ -2066,7 +2908,9 @@
     // so we have to check what we're editing
     
     BOOL showRuler = [[NSUserDefaults standardUserDefaults] boolForKey:CP_ShowRuler];
-    NSColor *textColor = [NSUnarchiver unarchiveObjectWithData:[[NSUserDefaults standardUserDefaults] objectForKey:CP_TextColor]];
+    NSColor *textColor = [[CPPreferenceSnapshot currentSnapshot] textColor];
+    
+    needsBackup = YES;  // The format might have changed, so the backup has to be redone
     
     // Set format-specific properties
     
@@ -2115,18 +2959,143 @@
     }
 }
 
+/***** Apply the preferences (for Apply to All) *****/
+
+/*
+ * Apply to All used to set everything on every document and then call
+ * updateView, which unarchived the text color again and set the font
+ * and color of every plain text document, even when they were already
+ * right (and that makes the whole thing get laid out again).  Now we
+ * only change what doesn't match.  The caller should wrap this in
+ * beginEditing/endEditing, so layout waits until it's done.
+ */
+
+- (BOOL)applyPreferences:(CPPreferenceSnapshot *)prefs
+{
+    NSToolbar *toolbar = [[textView window] toolbar];
+    BOOL changed = NO;
+    
+    // Set the background color
+    
+    if (![[textView backgroundColor] isEqual:[prefs backgroundColor]])
+    {
+        [textView setBackgroundColor:[prefs backgroundColor]];
+        changed = YES;
+    }
+    
+    // Set the ruler's visibility
+    
+    if ([textView usesRuler] && [textView isRulerVisible] != [prefs showRuler])
+    {
+        [textView setRulerVisible:[prefs showRuler]];
+        changed = YES;
+    }
+    
+    // Set continuous spell checking enabled or not
+    
+    if ([textView isContinuousSpellCheckingEnabled] != [prefs spellChecking])
+    {
+        [textView setContinuousSpellCheckingEnabled:[prefs spellChecking]];
+        changed = YES;
+    }
+    
+    // Set toolbar's visibility
+    
+    if ([toolbar isVisible] != [prefs showToolbar])
+    {
+        [toolbar setVisible:[prefs showToolbar]];
+        changed = YES;
+    }
+    
+    // Plain text uses the plain text font and text color for everything
+    
+    if (plainText)
+    {
+        if (![self allTextHasAttribute:NSFontAttributeName value:[prefs plainTextFont]])
+        {
+            [textView setFont:[prefs plainTextFont]];
+            changed = YES;
+        }
+        
+        if (![self allTextHasAttribute:NSForegroundColorAttributeName value:[prefs textColor]])
+        {
+            [textView setTextColor:[prefs textColor]];
+            changed = YES;
+        }
+    }
+    
+    return changed;
+}
+
+/***** Does all of the text have the same attribute? *****/
+
+// This only has to look at the first run
+
+- (BOOL)allTextHasAttribute:(NSString *)name value:(id)value
+{
+    NSRange wholeText = NSMakeRange(0, [textStorage length]);
+    NSRange effectiveRange;
+    id currentValue;
+    
+    if (wholeText.length == 0)
+        return [[[textView typingAttributes] objectForKey:name] isEqual:value];
+    
+    currentValue = [textStorage attribute:name atIndex:0 longestEffectiveRange:&effectiveRange inRange:wholeText];
+    
+    return (NSEqualRanges(effectiveRange, wholeText) && [currentValue isEqual:value]);
+}
+
 /***** Update the string (if this is plain text) *****/
 
+/*
+ * This used to copy the whole text out of the text view every time
+ * it changed.  Now string comes straight from the text storage, so
+ * all we have to do is let go of the text we were loaded with (when
+ * a backup is recovered) once it's in the text view.
+ */
+
 - (void)updateString
 {
     // RTF/RTFD doesn't use a string -- it uses a data object
     
     if (plainText)
     {
-        [self setString:[textView string]];
+        [self setString:nil];
     }
 }
 
+/***** Keep track of changes to the text *****/
+
+/*
+ * This is the text storage's delegate method.  Anything we
+ * encoded in the background is out of date now.
+ */
+
+- (void)textStorageDidProcessEditing:(NSNotification *)notification
+{
+    changeGeneration++;
+    
+    if (exportWrapper != nil)
+    {
+        [exportWrapper release];
+        exportWrapper = nil;
+    }
+}
+
+/***** Don't finish encoding a document that's been closed *****/
+
+- (void)close
+{
+    [self hideExportSheet];
+    [exportTask cancel];
+    [exportTask release];
+    exportTask = nil;
+    [[CPWorkerPool sharedPool] cancelTasksForTarget:self];
+    [[CPFindResultsController sharedController] forgetDocument:self];
+    
+    [super close];
+}
+
 /***** Override the dealloc method so we can release our own objects *****/
 
 // We're tidy programmers, so we have to clean up after ourselves when we're done
@@ -2135,7 +3104,13 @@
 {
     // Release instance objects we allocated memory for
     [fileContents release];
+    [fileWrapper release];
+    [textData release];
+    [statistics release];  // Has to go before the text storage it's watching
+    [exportTask release];
+    [exportWrapper release];
     [textStorage release];
+    [attachmentCache release];  // The pictures' cells keep it around as long as they need it
     
     [super dealloc];  // ...we now return to the previously scheduled deallocation.
 }
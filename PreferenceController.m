@@ -31,6 +31,10 @@
  - 05/23/05: Added word count
  - 06/07/05: FINALLY COMPLETED COCOAPAD 1.0!!!
  - 10/14/07: Released CocoaPad v1.1, with 2 bug fixes!
+ - 10/17/26: Apply to All reads the preferences once, skips documents that
+             already match, and lets layout wait until it's done.
+ - 10/17/26: Changing the fonts or resetting the preferences throws out the
+             shared CPPreferenceSnapshot.
  
  */
 
@@ -38,6 +42,7 @@
 #import "MyDocument.h"
 #import "InterfaceController.h"
 #import "LocalizedStrings.h"
+#import "CPPreferenceSnapshot.h"
 
 /*************/
 /* Constants */
@@ -282,6 +287,8 @@ enum FORMAT { CPDFORMAT = 0, RTFFORMAT = 1, RTFDFORMAT = 2, DOCFORMAT = 3, TXTFO
         [NSFont setUserFixedPitchFont:newFont];
         [plainTextFontNameField setStringValue:[NSString stringWithFormat:fontText, [newFont displayName], [newFont pointSize]]];
     }
+    
+    [CPPreferenceSnapshot invalidateCurrentSnapshot];  // The default text attributes use the fonts
 }
 
 /***** Change the default document format *****/
@@ -403,30 +410,44 @@ enum FORMAT { CPDFORMAT = 0, RTFFORMAT = 1, RTFDFORMAT = 2, DOCFORMAT = 3, TXTFO
 {
     if (result == NSAlertDefaultReturn)
     {
-        // Run through all the documents and apply changes
+        // Read the preferences once, for all of the documents
         
-        NSEnumerator *documentList = [[[NSDocumentController sharedDocumentController] documents] objectEnumerator];
+        NSDate *start = [NSDate date];
+        CPPreferenceSnapshot *prefs = [CPPreferenceSnapshot currentSnapshot];
+        NSArray *documents = [[NSDocumentController sharedDocumentController] documents];
+        NSEnumerator *documentList;
         MyDocument *document;
-        NSTextView *textView;
+        unsigned changed = 0;
+        
+        // Hold off on layout until every document is done
+        
+        documentList = [documents objectEnumerator];
         
         while (document = [documentList nextObject])
         {
-            textView = [document textView];
-            
-            // Set the background color
-            [textView setBackgroundColor:[NSUnarchiver unarchiveObjectWithData:[[NSUserDefaults standardUserDefaults] objectForKey:CP_BackgroundColor]]];
-            
-            // Set the ruler's visibility
-            [textView setRulerVisible:[[NSUserDefaults standardUserDefaults] boolForKey:CP_ShowRuler]];
-            
-            // Set continuous spell checking enabled or not
-            [textView setContinuousSpellCheckingEnabled:[[NSUserDefaults standardUserDefaults] boolForKey:CP_SpellChecking]];
-            
-            // Set toolbar's visibility
-            [[[textView window] toolbar] setVisible:[[NSUserDefaults standardUserDefaults] boolForKey:CP_ShowToolbar]];
-            
-            // And update the text view
-            [document updateView];
+            [[[document textView] textStorage] beginEditing];
+        }
+        
+        // Run through all the documents and apply changes
+        
+        documentList = [documents objectEnumerator];
+        
+        while (document = [documentList nextObject])
+        {
+            if ([document applyPreferences:prefs])
+                changed++;
+        }
+        
+        documentList = [documents objectEnumerator];
+        
+        while (document = [documentList nextObject])
+        {
+            [[[document textView] textStorage] endEditing];
+        }
+        
+        if ([[NSUserDefaults standardUserDefaults] boolForKey:CP_LogPerformance])
+        {
+            NSLog(@"Apply to All: changed %u of %u document(s) in %.3f sec", changed, [documents count], -[start timeIntervalSinceNow]);
         }
     }
     
@@ -461,6 +482,7 @@ enum FORMAT { CPDFORMAT = 0, RTFFORMAT = 1, RTFDFORMAT = 2, DOCFORMAT = 3, TXTFO
     [prefs removeObjectForKey:CP_SaveBackupInterval];
     [NSFont setUserFont:[NSFont fontWithName:CP_RTFFont size:12.0]];
     [NSFont setUserFixedPitchFont:[NSFont fontWithName:CP_TextFont size:10.0]];
+    [CPPreferenceSnapshot invalidateCurrentSnapshot];
     
     // Extract some preferences that aren't regular booleans or strings
     
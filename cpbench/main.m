@@ -0,0 +1,1142 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- cpbench/main.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ cpbench times the parts of CocoaPad that have to keep up with huge
+ documents, without opening any windows.
+ 
+ Usage: cpbench edits [-n <edits>] [-o <folder>] [-compare] [<MB> ...]
+        cpbench replace [-n <matches>] [-compare]
+        cpbench load [-o <folder>] [<MB> ...]
+        cpbench attachments [<count> ...]
+        cpbench statistics [-n <edits>] [-o <folder>] [<MB> ...]
+        cpbench typing [-n <keystrokes>]
+ 
+ edits makes a plain text file of each size (10, 100, and 1024 MB unless
+ you give your own), opens it in a CPPieceTableStorage the way CocoaPad
+ does, and makes random edits all over it: mostly typing a few characters,
+ some deleting, and some pasting a line.  It prints how long opening, the
+ edits, reading the whole text back, and saving took.  The edits are the
+ same every run, so the numbers can be compared.
+ 
+ With -compare, the same edits are made on a regular NSTextStorage too
+ (which needs the whole file in memory, twice as big, so be careful with
+ the 1 GB file), and the two texts are checked against each other.
+ 
+ The files are made in the -o folder (or the temporary folder), and are
+ deleted afterwards.
+ 
+ replace makes a document with a million matches (or -n), and times
+ CPTextSearch finding them all (with and without ignoring case) and
+ replacing them all, and then undoing that, in a regular NSTextStorage and
+ in a CPPieceTableStorage.  It checks that undoing gives back the original
+ text.  With -compare, it also replaces them one at a time, like the find
+ panel's Replace All does (that's slow, so use a smaller -n).
+ 
+ load makes a formatted document of each size (1 and 10 MB unless you give
+ your own), with a picture every 200 lines, and saves it as plain text,
+ RTF, RTFD, Word (if it can), and CPD.  Then it opens each file the way
+ CocoaPad used to (parsing rich text twice, and turning RTFD packages into
+ RTFD data and back first) and the way it does now, and prints both times.
+ It fails if opening a file takes longer than it used to, or if the two
+ ways don't come up with the same number of characters.
+ 
+ attachments makes documents with 10, 100, 1,000, and 10,000 pictures (or
+ the counts you give), and times taking them all out the way CocoaPad used
+ to (deleting them one at a time) and with CPDocumentCodec's single pass.
+ It checks that both leave the same text behind.
+ 
+ statistics opens a plain text file of each size (1 and 10 MB unless you
+ give your own) in a regular NSTextStorage, and keeps a CPDocumentStatistics
+ on it while it makes 1,000 (or -n) of the same random edits as edits, one
+ at a time, asking for the word count after each one.  It prints how long
+ each edit's recount took, next to counting the whole text from scratch and
+ counting it the way Word Count used to (with the text storage's words,
+ paragraphs, and characters arrays).  It fails if the counts it kept up to
+ date don't match counting from scratch.
+ 
+ typing types 10,000 keystrokes (or -n) into a CPTextView, one insertText:
+ at a time, the way the keyboard does.  It's the same few sentences over
+ and over, with plenty of single and double quotes in them.  It types them
+ once with smart quotes and once without, and prints the time per
+ keystroke for each.  It fails if a straight quote gets through with smart
+ quotes on, or if the text doesn't come out exactly as typed with them off.
+ The text view isn't in a window, but it still needs the window server.
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: Added replace.
+ - 10/17/26: Added load.
+ - 10/17/26: Added attachments.
+ - 10/17/26: Added statistics.
+ - 10/17/26: Added typing.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+#import <AppKit/AppKit.h>
+#import "CPDocumentCodec.h"
+#import "CPPieceTableStorage.h"
+#import "CPTextSearch.h"
+#import "CPAttachmentCache.h"
+#import "CPDocumentStatistics.h"
+#import "CPTextView.h"
+
+// For printf(), random(), and strcmp()
+#import <stdio.h>
+#import <stdlib.h>
+#import <string.h>
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_DefaultEditCount 100000
+#define CP_DefaultMatchCount 1000000
+#define CP_DefaultStatisticsEditCount 1000  // Each one is counted separately
+#define CP_DefaultKeystrokeCount 10000
+#define CP_RandomSeed 1984  // The same edits every time
+#define CP_ReadChunkLength (64 * 1024)  // In characters
+#define CP_PictureInterval 200  // Lines between pictures in a formatted document
+#define CP_PictureSize 64  // In pixels
+#define CP_AttachmentSpacing 10  // Paragraphs between pictures in the attachments documents
+
+static volatile unsigned long CPChecksum;  // So reading the text can't be optimized out
+
+// The preferences CPTextView reads (InterfaceController isn't in here)
+
+NSString *CP_EnableSmartQuotes = @"EnableSmartQuotes";
+NSString *CP_LogPerformance = @"LogPerformance";
+
+/*************/
+/* Functions */
+/*************/
+
+/***** Print how to use it *****/
+
+static void CPPrintUsage(void)
+{
+    fprintf(stderr, "usage: cpbench edits [-n <edits>] [-o <folder>] [-compare] [<MB> ...]\n");
+    fprintf(stderr, "       cpbench replace [-n <matches>] [-compare]\n");
+    fprintf(stderr, "       cpbench load [-o <folder>] [<MB> ...]\n");
+    fprintf(stderr, "       cpbench attachments [<count> ...]\n");
+    fprintf(stderr, "       cpbench statistics [-n <edits>] [-o <folder>] [<MB> ...]\n");
+    fprintf(stderr, "       cpbench typing [-n <keystrokes>]\n");
+}
+
+/***** Make a plain text file that looks like a log *****/
+
+static BOOL CPMakeTextFile(NSString *path, unsigned long long size)
+{
+    FILE *file = fopen([path fileSystemRepresentation], "wb");
+    char line[128];
+    unsigned long long written = 0;
+    unsigned number = 0;
+    
+    if (file == NULL)
+        return NO;
+    
+    while (written < size)
+    {
+        int length = sprintf(line, "%08u The quick brown fox jumps over the lazy dog, again and again.\n", number++);
+        
+        if (written + length > size)
+            length = (int)(size - written);
+        
+        if (fwrite(line, 1, length, file) != (size_t)length)
+        {
+            fclose(file);
+            return NO;
+        }
+        
+        written += length;
+    }
+    
+    return (fclose(file) == 0);
+}
+
+/***** Make a picture, like a small pasted screenshot *****/
+
+// Each one is a little different, so they're different files
+
+static NSAttributedString *CPMakePicture(unsigned number)
+{
+    NSBitmapImageRep *rep = [[NSBitmapImageRep alloc] initWithBitmapDataPlanes:NULL pixelsWide:CP_PictureSize pixelsHigh:CP_PictureSize bitsPerSample:8 samplesPerPixel:3 hasAlpha:NO isPlanar:NO colorSpaceName:NSDeviceRGBColorSpace bytesPerRow:0 bitsPerPixel:0];
+    unsigned char *pixels = [rep bitmapData];
+    NSFileWrapper *wrapper;
+    NSTextAttachment *attachment;
+    unsigned i;
+    
+    for (i = 0; i < [rep bytesPerRow] * CP_PictureSize; i++)
+    {
+        pixels[i] = (unsigned char)(i * 7 + number);
+    }
+    
+    wrapper = [[[NSFileWrapper alloc] initRegularFileWithContents:[rep TIFFRepresentation]] autorelease];
+    [wrapper setPreferredFilename:[NSString stringWithFormat:@"picture%u.tiff", number]];
+    attachment = [[[NSTextAttachment alloc] initWithFileWrapper:wrapper] autorelease];
+    
+    [rep release];
+    
+    return [NSAttributedString attributedStringWithAttachment:attachment];
+}
+
+/***** Make a formatted document *****/
+
+/*
+ * The same lines as CPMakeTextFile, but every fifth one is red and
+ * every seventh one is underlined, and a picture goes after every
+ * pictureInterval-th line (none if it's 0).  Colors instead of
+ * fonts, since there are no fonts without a window server.
+ */
+
+static NSAttributedString *CPMakeRichText(unsigned long long size, unsigned pictureInterval)
+{
+    NSMutableAttributedString *text = [[[NSMutableAttributedString alloc] init] autorelease];
+    NSDictionary *plain = [NSDictionary dictionaryWithObject:[NSColor blackColor] forKey:NSForegroundColorAttributeName];
+    NSDictionary *red = [NSDictionary dictionaryWithObject:[NSColor redColor] forKey:NSForegroundColorAttributeName];
+    NSDictionary *underlined = [NSDictionary dictionaryWithObjectsAndKeys:[NSColor blackColor], NSForegroundColorAttributeName, [NSNumber numberWithInt:NSUnderlineStyleSingle], NSUnderlineStyleAttributeName, nil];
+    unsigned number = 0;
+    
+    [text beginEditing];
+    
+    while ([text length] < size)
+    {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSString *line = [NSString stringWithFormat:@"%08u The quick brown fox jumps over the lazy dog, again and again.\n", number];
+        NSDictionary *attributes = (number % 5 == 0) ? red : (number % 7 == 0) ? underlined : plain;
+        
+        [text appendAttributedString:[[[NSAttributedString alloc] initWithString:line attributes:attributes] autorelease]];
+        
+        if (pictureInterval > 0 && number % pictureInterval == pictureInterval - 1)
+        {
+            [text appendAttributedString:CPMakePicture(number / pictureInterval)];
+            [text appendAttributedString:[[[NSAttributedString alloc] initWithString:@"\n" attributes:plain] autorelease]];
+        }
+        
+        number++;
+        [pool release];
+    }
+    
+    [text endEditing];
+    
+    return text;
+}
+
+/***** Make one random edit on a text storage *****/
+
+/*
+ * Seven out of ten edits type a few characters, two delete a few,
+ * and one pastes a whole line.  Call srandom() with CP_RandomSeed
+ * first, so it's the same edits every time.
+ */
+
+static void CPMakeEdit(NSTextStorage *text)
+{
+    NSString *typing = @"abcdefgh";
+    NSString *line = @"A whole line of text that was pasted in from somewhere else.\n";
+    unsigned length = [text length];
+    unsigned location = (length > 0) ? (unsigned)random() % length : 0;
+    unsigned kind = (unsigned)random() % 10;
+    
+    if (kind < 7)
+    {
+        [text replaceCharactersInRange:NSMakeRange(location, 0) withString:[typing substringToIndex:1 + (unsigned)random() % [typing length]]];
+    }
+    
+    else if (kind < 9)
+    {
+        [text replaceCharactersInRange:NSMakeRange(location, MIN(1 + (unsigned)random() % 16, length - location)) withString:@""];
+    }
+    
+    else
+    {
+        [text replaceCharactersInRange:NSMakeRange(location, 0) withString:line];
+    }
+}
+
+/***** Make the same random edits on a text storage *****/
+
+static NSTimeInterval CPMakeEdits(NSTextStorage *text, unsigned count)
+{
+    NSDate *start = [NSDate date];
+    unsigned i;
+    
+    srandom(CP_RandomSeed);
+    
+    [text beginEditing];
+    
+    for (i = 0; i < count; i++)
+    {
+        CPMakeEdit(text);
+    }
+    
+    [text endEditing];
+    
+    return -[start timeIntervalSinceNow];
+}
+
+/***** Read the whole text back, the way the layout manager would *****/
+
+static NSTimeInterval CPReadText(NSString *string)
+{
+    unichar *buffer = malloc(CP_ReadChunkLength * sizeof(unichar));
+    unsigned length = [string length];
+    unsigned location;
+    NSDate *start = [NSDate date];
+    
+    for (location = 0; location < length; location += CP_ReadChunkLength)
+    {
+        unsigned count = MIN((unsigned)CP_ReadChunkLength, length - location);
+        
+        [string getCharacters:buffer range:NSMakeRange(location, count)];
+        CPChecksum += buffer[count - 1];
+    }
+    
+    free(buffer);
+    
+    return -[start timeIntervalSinceNow];
+}
+
+/***** Time one file size *****/
+
+static BOOL CPBenchmarkEdits(NSString *folder, unsigned megabytes, unsigned editCount, BOOL compare)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *path = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"cpbench-%u.txt", megabytes]];
+    NSString *savedPath = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"cpbench-%u-saved.txt", megabytes]];
+    NSDictionary *attributes = [NSDictionary dictionaryWithObject:[NSColor blackColor] forKey:NSForegroundColorAttributeName];  // No fonts without a window server
+    CPPieceTableStorage *storage;
+    NSData *data;
+    NSStringEncoding encoding;
+    unsigned headerLength;
+    NSDate *start;
+    NSTimeInterval openTime, editTime, readTime, saveTime;
+    BOOL succeeded = YES;
+    
+    printf("%u MB:\n", megabytes);
+    fflush(stdout);
+    
+    if (!CPMakeTextFile(path, (unsigned long long)megabytes * 1048576))
+    {
+        fprintf(stderr, "cpbench: couldn't make %s\n", [path fileSystemRepresentation]);
+        [pool release];
+        return NO;
+    }
+    
+    // Open it the way CocoaPad does
+    
+    start = [NSDate date];
+    data = [[NSData alloc] initWithContentsOfMappedFile:path];
+    encoding = [CPDocumentCodec encodingOfTextData:data headerLength:&headerLength];
+    storage = [[CPPieceTableStorage alloc] initWithData:data encoding:encoding headerLength:headerLength attributes:attributes];
+    [data release];
+    openTime = -[start timeIntervalSinceNow];
+    
+    editTime = CPMakeEdits(storage, editCount);
+    readTime = CPReadText([storage string]);
+    
+    start = [NSDate date];
+    
+    if (![storage writeToFile:savedPath encoding:NSUTF8StringEncoding])
+    {
+        fprintf(stderr, "cpbench: couldn't save %s\n", [savedPath fileSystemRepresentation]);
+        succeeded = NO;
+    }
+    
+    saveTime = -[start timeIntervalSinceNow];
+    
+    printf("  piece table:  open %.3f sec, %u edits in %.3f sec (%.2f us/edit, %u pieces), read %.3f sec, save %.3f sec\n", openTime, editCount, editTime, (editCount > 0) ? editTime * 1000000.0 / editCount : 0.0, [storage pieceCount], readTime, saveTime);
+    fflush(stdout);
+    
+    // The same thing with the regular text storage
+    
+    if (compare)
+    {
+        NSAutoreleasePool *comparePool = [[NSAutoreleasePool alloc] init];
+        NSTextStorage *text;
+        
+        start = [NSDate date];
+        data = [NSData dataWithContentsOfMappedFile:path];
+        text = [[NSTextStorage alloc] initWithString:[CPDocumentCodec stringFromTextData:data encoding:encoding location:&headerLength maxLength:[data length]] attributes:attributes];
+        openTime = -[start timeIntervalSinceNow];
+        
+        editTime = CPMakeEdits(text, editCount);
+        readTime = CPReadText([text string]);
+        
+        start = [NSDate date];
+        [[CPDocumentCodec dataFromText:text format:CPFormatText] writeToFile:savedPath atomically:YES];
+        saveTime = -[start timeIntervalSinceNow];
+        
+        printf("  NSTextStorage: open %.3f sec, %u edits in %.3f sec (%.2f us/edit), read %.3f sec, save %.3f sec\n", openTime, editCount, editTime, (editCount > 0) ? editTime * 1000000.0 / editCount : 0.0, readTime, saveTime);
+        
+        if (![[text string] isEqualToString:[storage string]])
+        {
+            printf("  the texts don't match!\n");
+            succeeded = NO;
+        }
+        
+        [text release];
+        [comparePool release];
+    }
+    
+    [storage release];
+    
+    [[NSFileManager defaultManager] removeFileAtPath:path handler:nil];
+    [[NSFileManager defaultManager] removeFileAtPath:savedPath handler:nil];
+    
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Open a file the way CocoaPad used to *****/
+
+/*
+ * Rich text was parsed into a string nobody used, and then parsed
+ * again by the text view.  RTFD packages were read into memory,
+ * parsed, and turned into RTFD data first, which then went through
+ * the same thing.  Word files were read through the text storage,
+ * and plain text files were read into a string and copied into the
+ * text storage.  Returns how many characters were loaded.
+ */
+
+static unsigned CPLoadTheOldWay(NSString *path, CPDocumentFormat format, NSDictionary *attributes)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSTextStorage *storage = [[[NSTextStorage alloc] init] autorelease];
+    NSData *data = nil;
+    unsigned length;
+    
+    switch (format)
+    {
+        case CPFormatText:
+        {
+            NSString *string = [[[NSString alloc] initWithContentsOfFile:path] autorelease];
+            [storage setAttributedString:[[[NSAttributedString alloc] initWithString:string attributes:attributes] autorelease]];
+            break;
+        }
+        
+        case CPFormatWord:
+            [storage readFromURL:[NSURL fileURLWithPath:path] options:[NSDictionary dictionary] documentAttributes:nil];
+            break;
+        
+        case CPFormatRTFD:
+        {
+            NSFileWrapper *wrapper = [[[NSFileWrapper alloc] initWithPath:path] autorelease];
+            NSAttributedString *tempString = [[[NSAttributedString alloc] initWithRTFDFileWrapper:wrapper documentAttributes:nil] autorelease];
+            
+            data = [tempString RTFDFromRange:NSMakeRange(0, [tempString length]) documentAttributes:nil];
+            
+            // ...and then it's loaded like CPD (this falls through)
+        }
+        
+        case CPFormatCPD:
+        case CPFormatRTF:
+        {
+            NSAttributedString *unused, *parsed;
+            
+            if (data == nil)
+                data = [NSData dataWithContentsOfFile:path];
+            
+            // Once for nothing, and once by the text view
+            
+            if (format == CPFormatRTF)
+            {
+                unused = [[NSAttributedString alloc] initWithRTF:data documentAttributes:nil];
+                parsed = [[NSAttributedString alloc] initWithRTF:data documentAttributes:nil];
+            }
+            
+            else
+            {
+                unused = [[NSAttributedString alloc] initWithRTFD:data documentAttributes:nil];
+                parsed = [[NSAttributedString alloc] initWithRTFD:data documentAttributes:nil];
+            }
+            
+            [storage replaceCharactersInRange:NSMakeRange(0, 0) withAttributedString:parsed];
+            
+            [unused release];
+            [parsed release];
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    length = [storage length];
+    [pool release];
+    
+    return length;
+}
+
+/***** Open a file the way CocoaPad does now *****/
+
+// The same steps as MyDocument's readFromFile:ofType: and loadDocument
+
+static unsigned CPLoadTheNewWay(NSString *path, CPDocumentFormat format, NSDictionary *attributes)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSAttributedString *text;
+    unsigned length;
+    
+    if (format == CPFormatText)
+    {
+        NSData *data = [NSData dataWithContentsOfMappedFile:path];
+        unsigned headerLength;
+        NSStringEncoding encoding = [CPDocumentCodec encodingOfTextData:data headerLength:&headerLength];
+        CPPieceTableStorage *storage = [[[CPPieceTableStorage alloc] initWithData:data encoding:encoding headerLength:headerLength attributes:attributes] autorelease];
+        
+        length = [storage length];
+    }
+    
+    else
+    {
+        NSTextStorage *storage = [[[NSTextStorage alloc] init] autorelease];
+        
+        if (format == CPFormatRTFD)
+            text = [CPDocumentCodec textFromFileWrapper:[CPDocumentCodec fileWrapperWithContentsOfPath:path] format:format];
+        
+        else
+            text = [CPDocumentCodec textFromData:(format == CPFormatCPD) ? [NSData dataWithContentsOfMappedFile:path] : [NSData dataWithContentsOfFile:path] format:format];
+        
+        if ([text containsAttachments])
+        {
+            [[[[CPAttachmentCache alloc] init] autorelease] adoptAttachmentsInText:text];
+        }
+        
+        [storage beginEditing];
+        [storage setAttributedString:text];
+        [storage endEditing];
+        
+        length = [storage length];
+    }
+    
+    [pool release];
+    
+    return length;
+}
+
+/***** Time opening one document in every format *****/
+
+static BOOL CPBenchmarkLoad(NSString *folder, unsigned megabytes)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSDictionary *attributes = [NSDictionary dictionaryWithObject:[NSColor blackColor] forKey:NSForegroundColorAttributeName];
+    CPDocumentFormat formats[] = {CPFormatText, CPFormatRTF, CPFormatRTFD, CPFormatWord, CPFormatCPD};
+    NSAttributedString *text;
+    BOOL succeeded = YES;
+    unsigned i;
+    
+    printf("%u MB:\n", megabytes);
+    fflush(stdout);
+    
+    text = CPMakeRichText((unsigned long long)megabytes * 1048576, CP_PictureInterval);
+    
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+    {
+        NSAutoreleasePool *formatPool = [[NSAutoreleasePool alloc] init];
+        NSString *extension = [CPDocumentCodec pathExtensionForFormat:formats[i]];
+        NSString *path = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"cpbench-%u.%@", megabytes, extension]];
+        NSTimeInterval oldTime, newTime;
+        unsigned oldLength, newLength;
+        NSDate *start;
+        BOOL wrote;
+        
+        // Save it
+        
+        if (formats[i] == CPFormatRTFD)
+        {
+            wrote = [[CPDocumentCodec fileWrapperFromText:text format:formats[i]] writeToFile:path atomically:NO updateFilenames:NO];
+        }
+        
+        else
+        {
+            NSData *data = [CPDocumentCodec dataFromText:text format:formats[i]];
+            wrote = (data != nil && [data writeToFile:path atomically:NO]);
+        }
+        
+        if (!wrote)
+        {
+            printf("  %-4s skipped (can't save it here)\n", [extension UTF8String]);
+            [formatPool release];
+            continue;
+        }
+        
+        // Open it both ways (the file is in the disk cache for both)
+        
+        start = [NSDate date];
+        oldLength = CPLoadTheOldWay(path, formats[i], attributes);
+        oldTime = -[start timeIntervalSinceNow];
+        
+        start = [NSDate date];
+        newLength = CPLoadTheNewWay(path, formats[i], attributes);
+        newTime = -[start timeIntervalSinceNow];
+        
+        printf("  %-4s the old way %.3f sec, now %.3f sec (%.1fx), %u characters\n", [extension UTF8String], oldTime, newTime, (newTime > 0) ? oldTime / newTime : 0.0, newLength);
+        fflush(stdout);
+        
+        if (oldLength != newLength)
+        {
+            printf("  %s: the old way loaded %u characters!\n", [extension UTF8String], oldLength);
+            succeeded = NO;
+        }
+        
+        if (newTime > oldTime)
+        {
+            printf("  %s: opening is slower than it used to be!\n", [extension UTF8String]);
+            succeeded = NO;
+        }
+        
+        [[NSFileManager defaultManager] removeFileAtPath:path handler:nil];
+        [formatPool release];
+    }
+    
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Remove the attachments the way CocoaPad used to *****/
+
+// Ali Ozer's loop from TextEdit, which deletes them one at a time
+
+static void CPRemoveAttachmentsTheOldWay(NSTextStorage *textStorage)
+{
+    unsigned location = 0;
+    unsigned end = [textStorage length];
+    
+    [textStorage beginEditing];
+    
+    while (location < end)
+    {
+        NSRange attachmentRange;
+        NSTextAttachment *attachment = [textStorage attribute:NSAttachmentAttributeName atIndex:location longestEffectiveRange:&attachmentRange inRange:NSMakeRange(location, end - location)];
+        
+        if (attachment != nil)
+        {
+            if ([[textStorage string] characterAtIndex:location] == NSAttachmentCharacter)
+            {
+                [textStorage replaceCharactersInRange:NSMakeRange(location, 1) withString:@""];
+                end = [textStorage length];
+            }
+            
+            else
+            {
+                location++;
+            }
+        }
+        
+        else
+        {
+            location = NSMaxRange(attachmentRange);
+        }
+    }
+    
+    [textStorage endEditing];
+}
+
+/***** Time taking the pictures out of a document *****/
+
+/*
+ * The pictures all share the same file contents (so 10,000 of them
+ * don't take up much memory), but each one is its own attachment.
+ */
+
+static BOOL CPBenchmarkAttachments(unsigned count)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSDictionary *plain = [NSDictionary dictionaryWithObject:[NSColor blackColor] forKey:NSForegroundColorAttributeName];
+    NSAttributedString *paragraph = [[[NSAttributedString alloc] initWithString:@"Some text between the pictures, the way a photo album would have it.\n" attributes:plain] autorelease];
+    NSData *picture = [[[CPMakePicture(0) attribute:NSAttachmentAttributeName atIndex:0 effectiveRange:NULL] fileWrapper] regularFileContents];
+    NSMutableAttributedString *text = [[[NSMutableAttributedString alloc] init] autorelease];
+    NSTextStorage *oldText, *newText;
+    NSTimeInterval oldTime, newTime;
+    NSDate *start;
+    unsigned removed, bytes, i, j;
+    BOOL succeeded = YES;
+    
+    [text beginEditing];
+    
+    for (i = 0; i < count; i++)
+    {
+        NSFileWrapper *wrapper = [[NSFileWrapper alloc] initRegularFileWithContents:picture];
+        NSTextAttachment *attachment;
+        
+        [wrapper setPreferredFilename:[NSString stringWithFormat:@"picture%u.tiff", i]];
+        attachment = [[NSTextAttachment alloc] initWithFileWrapper:wrapper];
+        
+        for (j = 0; j < CP_AttachmentSpacing; j++)
+        {
+            [text appendAttributedString:paragraph];
+        }
+        
+        [text appendAttributedString:[NSAttributedString attributedStringWithAttachment:attachment]];
+        
+        [attachment release];
+        [wrapper release];
+    }
+    
+    [text appendAttributedString:paragraph];
+    [text endEditing];
+    
+    oldText = [[[NSTextStorage alloc] initWithAttributedString:text] autorelease];
+    newText = [[[NSTextStorage alloc] initWithAttributedString:text] autorelease];
+    
+    start = [NSDate date];
+    CPRemoveAttachmentsTheOldWay(oldText);
+    oldTime = -[start timeIntervalSinceNow];
+    
+    start = [NSDate date];
+    removed = [CPDocumentCodec removeAttachmentsFromText:newText bytes:&bytes];
+    newTime = -[start timeIntervalSinceNow];
+    
+    printf("%5u pictures (%u characters): one at a time %.4f sec, one pass %.4f sec (%.1fx), %u bytes of pictures\n", count, [text length], oldTime, newTime, (newTime > 0) ? oldTime / newTime : 0.0, bytes);
+    fflush(stdout);
+    
+    if (removed != count || [newText containsAttachments])
+    {
+        printf("  removed %u instead of %u!\n", removed, count);
+        succeeded = NO;
+    }
+    
+    if (![[newText string] isEqualToString:[oldText string]])
+    {
+        printf("  the texts don't match!\n");
+        succeeded = NO;
+    }
+    
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Time keeping the word count up to date *****/
+
+/*
+ * Every edit is its own change (not grouped with beginEditing), so
+ * the statistics get a notification for each one, like typing.
+ */
+
+static BOOL CPBenchmarkStatistics(NSString *folder, unsigned megabytes, unsigned editCount)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *path = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"cpbench-%u.txt", megabytes]];
+    NSDictionary *attributes = [NSDictionary dictionaryWithObject:[NSColor blackColor] forKey:NSForegroundColorAttributeName];
+    CPDocumentStatistics *statistics, *fromScratch;
+    NSTextStorage *text;
+    NSData *data;
+    NSStringEncoding encoding;
+    unsigned headerLength, i;
+    unsigned arrayCharacters, arrayWords, arrayParagraphs;
+    NSDate *start;
+    NSTimeInterval editTime = 0, countTime, scanTime, arrayTime;
+    BOOL succeeded = YES;
+    
+    printf("%u MB:\n", megabytes);
+    fflush(stdout);
+    
+    if (!CPMakeTextFile(path, (unsigned long long)megabytes * 1048576))
+    {
+        fprintf(stderr, "cpbench: couldn't make %s\n", [path fileSystemRepresentation]);
+        [pool release];
+        return NO;
+    }
+    
+    data = [NSData dataWithContentsOfMappedFile:path];
+    encoding = [CPDocumentCodec encodingOfTextData:data headerLength:&headerLength];
+    text = [[[NSTextStorage alloc] initWithString:[CPDocumentCodec stringFromTextData:data encoding:encoding location:&headerLength maxLength:[data length]] attributes:attributes] autorelease];
+    
+    [[NSFileManager defaultManager] removeFileAtPath:path handler:nil];
+    
+    // The first count is of the whole text
+    
+    start = [NSDate date];
+    statistics = [[[CPDocumentStatistics alloc] initWithTextStorage:text] autorelease];
+    countTime = -[start timeIntervalSinceNow];
+    
+    // Then each edit is counted as it's made
+    
+    srandom(CP_RandomSeed);
+    
+    for (i = 0; i < editCount; i++)
+    {
+        NSDate *editStart = [NSDate date];
+        
+        CPMakeEdit(text);
+        CPChecksum += [statistics wordCount];
+        
+        editTime -= [editStart timeIntervalSinceNow];
+    }
+    
+    // What it would take to count the edited text from scratch
+    
+    start = [NSDate date];
+    fromScratch = [[CPDocumentStatistics alloc] initWithTextStorage:text];
+    scanTime = -[start timeIntervalSinceNow];
+    
+    // ...and the way Word Count used to
+    
+    start = [NSDate date];
+    arrayWords = [[text words] count];
+    arrayParagraphs = [[text paragraphs] count];
+    arrayCharacters = [[text characters] count];
+    arrayTime = -[start timeIntervalSinceNow];
+    
+    printf("  first count %.3f sec; %u edits counted in %.3f sec (%.2f us/edit); from scratch %.3f sec; text storage arrays %.3f sec\n", countTime, editCount, editTime, (editCount > 0) ? editTime * 1000000.0 / editCount : 0.0, scanTime, arrayTime);
+    printf("  %u characters, %u words, %u paragraphs, %u lines (text storage arrays: %u characters, %u words, %u paragraphs)\n", [statistics characterCount], [statistics wordCount], [statistics paragraphCount], [statistics lineCount], arrayCharacters, arrayWords, arrayParagraphs);
+    fflush(stdout);
+    
+    if ([statistics characterCount] != [fromScratch characterCount] || [statistics wordCount] != [fromScratch wordCount] ||
+        [statistics paragraphCount] != [fromScratch paragraphCount] || [statistics lineCount] != [fromScratch lineCount])
+    {
+        printf("  counting from scratch got %u characters, %u words, %u paragraphs, %u lines!\n", [fromScratch characterCount], [fromScratch wordCount], [fromScratch paragraphCount], [fromScratch lineCount]);
+        succeeded = NO;
+    }
+    
+    if ([statistics characterCount] != [text length])
+    {
+        printf("  the text has %u characters!\n", [text length]);
+        succeeded = NO;
+    }
+    
+    [fromScratch release];
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Find and replace every match in one text *****/
+
+static BOOL CPBenchmarkReplace(NSMutableAttributedString *text, NSString *name, unsigned matchCount)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *original = [[[text string] copy] autorelease];
+    CPTextSearch *search = [[[CPTextSearch alloc] initWithPattern:@"needle" options:0] autorelease];
+    CPTextSearch *foldedSearch = [[[CPTextSearch alloc] initWithPattern:@"NEEDLE" options:CPSearchCaseInsensitive] autorelease];
+    NSData *ranges, *foldedRanges, *lengths, *undoRanges, *undoLengths, *redoRanges, *redoLengths;
+    NSAttributedString *replacement, *replaced;
+    NSDate *start;
+    NSTimeInterval findTime, foldedFindTime, replaceTime, undoTime;
+    BOOL succeeded = YES;
+    
+    start = [NSDate date];
+    ranges = [search rangesInString:[text string]];
+    findTime = -[start timeIntervalSinceNow];
+    
+    start = [NSDate date];
+    foldedRanges = [foldedSearch rangesInString:[text string]];
+    foldedFindTime = -[start timeIntervalSinceNow];
+    
+    start = [NSDate date];
+    replacement = [CPTextSearch replacementText:@"pin" forRanges:ranges inText:text lengths:&lengths];
+    replaced = [CPTextSearch replaceRanges:ranges inText:text withText:replacement lengths:lengths undoRanges:&undoRanges undoLengths:&undoLengths];
+    replaceTime = -[start timeIntervalSinceNow];
+    
+    if ([text length] != [original length] - matchCount * 3)
+    {
+        printf("  %s: replacing left %u characters instead of %u!\n", [name UTF8String], [text length], [original length] - matchCount * 3);
+        succeeded = NO;
+    }
+    
+    start = [NSDate date];
+    [CPTextSearch replaceRanges:undoRanges inText:text withText:replaced lengths:undoLengths undoRanges:&redoRanges undoLengths:&redoLengths];
+    undoTime = -[start timeIntervalSinceNow];
+    
+    if (![[text string] isEqualToString:original])
+    {
+        printf("  %s: undoing didn't give back the original!\n", [name UTF8String]);
+        succeeded = NO;
+    }
+    
+    if ([ranges length] / sizeof(NSRange) != matchCount || [foldedRanges length] / sizeof(NSRange) != matchCount)
+    {
+        printf("  %s: found %u (and %u ignoring case) instead of %u!\n", [name UTF8String], [ranges length] / sizeof(NSRange), [foldedRanges length] / sizeof(NSRange), matchCount);
+        succeeded = NO;
+    }
+    
+    printf("  %s: find all %.3f sec (%.3f sec ignoring case), replace all %.3f sec, undo %.3f sec\n", [name UTF8String], findTime, foldedFindTime, replaceTime, undoTime);
+    fflush(stdout);
+    
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Time replacing a lot of matches *****/
+
+// Every other word is a match
+
+static BOOL CPBenchmarkReplaceAll(unsigned matchCount, BOOL compare)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSDictionary *attributes = [NSDictionary dictionaryWithObject:[NSColor blackColor] forKey:NSForegroundColorAttributeName];
+    NSMutableData *data = [NSMutableData dataWithCapacity:matchCount * 16];
+    NSStringEncoding encoding;
+    unsigned headerLength;
+    NSTextStorage *text;
+    CPPieceTableStorage *storage;
+    NSString *string;
+    BOOL succeeded = YES;
+    unsigned i;
+    
+    for (i = 0; i < matchCount; i++)
+    {
+        [data appendBytes:"hay needle " length:11];
+    }
+    
+    printf("%u matches in %u characters:\n", matchCount, [data length]);
+    fflush(stdout);
+    
+    encoding = [CPDocumentCodec encodingOfTextData:data headerLength:&headerLength];
+    string = [[[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding] autorelease];
+    
+    text = [[NSTextStorage alloc] initWithString:string attributes:attributes];
+    succeeded = CPBenchmarkReplace(text, @"NSTextStorage", matchCount) && succeeded;
+    
+    storage = [[CPPieceTableStorage alloc] initWithData:data encoding:encoding headerLength:headerLength attributes:attributes];
+    succeeded = CPBenchmarkReplace(storage, @"piece table", matchCount) && succeeded;
+    [storage release];
+    
+    // The way the find panel does it
+    
+    if (compare)
+    {
+        NSData *ranges = [[[[CPTextSearch alloc] initWithPattern:@"needle" options:0] autorelease] rangesInString:string];
+        const NSRange *list = [ranges bytes];
+        NSDate *start = [NSDate date];
+        
+        [text beginEditing];
+        
+        for (i = [ranges length] / sizeof(NSRange); i > 0; i--)
+        {
+            [text replaceCharactersInRange:list[i - 1] withString:@"pin"];
+        }
+        
+        [text endEditing];
+        
+        printf("  one at a time: replace all %.3f sec\n", -[start timeIntervalSinceNow]);
+    }
+    
+    [text release];
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Type into a text view *****/
+
+// Returns the time per keystroke, in microseconds
+
+static double CPTypeKeystrokes(CPTextView *textView, NSString *keystrokes, BOOL smartQuotes)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    unsigned count = [keystrokes length];
+    NSDate *start;
+    NSTimeInterval time;
+    unsigned i;
+    
+    [[NSUserDefaults standardUserDefaults] setBool:smartQuotes forKey:CP_EnableSmartQuotes];
+    [textView userDefaultsDidChange:nil];
+    
+    [textView setString:@""];
+    
+    start = [NSDate date];
+    
+    for (i = 0; i < count; i++)
+    {
+        [textView insertText:[keystrokes substringWithRange:NSMakeRange(i, 1)]];
+    }
+    
+    time = -[start timeIntervalSinceNow];
+    
+    [pool release];
+    
+    return (count > 0) ? time * 1000000.0 / count : 0.0;
+}
+
+/***** Time typing, with and without smart quotes *****/
+
+static BOOL CPBenchmarkTyping(unsigned keystrokeCount)
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSString *sentences = @"\"Don't,\" she said.  'Fine' -- (\"it's 'only' a test\").\nHe wrote \"'Quoted' twice\" and left.\n";
+    NSMutableString *keystrokes = [NSMutableString stringWithCapacity:keystrokeCount];
+    CPTextView *textView;
+    NSString *typed;
+    double smartTime, plainTime;
+    BOOL succeeded = YES;
+    
+    while ([keystrokes length] < keystrokeCount)
+    {
+        [keystrokes appendString:sentences];
+    }
+    
+    [keystrokes deleteCharactersInRange:NSMakeRange(keystrokeCount, [keystrokes length] - keystrokeCount)];
+    
+    [NSApplication sharedApplication];  // The text view needs AppKit set up
+    
+    textView = [[CPTextView alloc] initWithFrame:NSMakeRect(0, 0, 500, 500)];
+    [[NSUserDefaults standardUserDefaults] setBool:NO forKey:CP_LogPerformance];
+    
+    smartTime = CPTypeKeystrokes(textView, keystrokes, YES);
+    typed = [[[textView string] copy] autorelease];
+    plainTime = CPTypeKeystrokes(textView, keystrokes, NO);
+    
+    printf("%u keystrokes: %.2f us/keystroke with smart quotes, %.2f us/keystroke without\n", keystrokeCount, smartTime, plainTime);
+    fflush(stdout);
+    
+    // The smart quotes come from CocoaPad's Localizable.strings, which
+    // cpbench doesn't have, so all we can check is the straight ones
+    
+    if ([typed rangeOfString:@"\""].location != NSNotFound || [typed rangeOfString:@"'"].location != NSNotFound)
+    {
+        printf("  straight quotes got through with smart quotes on!\n");
+        succeeded = NO;
+    }
+    
+    if (![[textView string] isEqualToString:keystrokes])
+    {
+        printf("  the text doesn't match what was typed with smart quotes off!\n");
+        succeeded = NO;
+    }
+    
+    [textView release];
+    [pool release];
+    
+    return succeeded;
+}
+
+/***** Main *****/
+
+int main(int argc, const char *argv[])
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray *sizes = [NSMutableArray array];
+    NSString *folder = NSTemporaryDirectory();
+    NSString *mode = (argc >= 2) ? [NSString stringWithUTF8String:argv[1]] : nil;
+    unsigned editCount = CP_DefaultEditCount;  // Or how many matches, for replace
+    BOOL compare = NO;
+    BOOL succeeded = YES;
+    NSEnumerator *list;
+    NSNumber *size;
+    int i;
+    
+    if ([mode isEqualToString:@"replace"])
+    {
+        editCount = CP_DefaultMatchCount;
+    }
+    
+    else if ([mode isEqualToString:@"statistics"])
+    {
+        editCount = CP_DefaultStatisticsEditCount;
+    }
+    
+    else if ([mode isEqualToString:@"typing"])
+    {
+        editCount = CP_DefaultKeystrokeCount;
+    }
+    
+    else if (![mode isEqualToString:@"edits"] && ![mode isEqualToString:@"load"] && ![mode isEqualToString:@"attachments"])
+    {
+        CPPrintUsage();
+        [pool release];
+        return 1;
+    }
+    
+    // Read the arguments
+    
+    for (i = 2; i < argc; i++)
+    {
+        NSString *argument = [NSString stringWithUTF8String:argv[i]];
+        
+        if ([argument isEqualToString:@"-n"] && i + 1 < argc && ([mode isEqualToString:@"edits"] || [mode isEqualToString:@"replace"] || [mode isEqualToString:@"statistics"] || [mode isEqualToString:@"typing"]))
+            editCount = atoi(argv[++i]);
+        
+        else if ([argument isEqualToString:@"-o"] && i + 1 < argc && ([mode isEqualToString:@"edits"] || [mode isEqualToString:@"load"] || [mode isEqualToString:@"statistics"]))
+            folder = [NSString stringWithUTF8String:argv[++i]];
+        
+        else if ([argument isEqualToString:@"-compare"] && ([mode isEqualToString:@"edits"] || [mode isEqualToString:@"replace"]))
+            compare = YES;
+        
+        else if ([argument intValue] > 0 && ![mode isEqualToString:@"replace"] && ![mode isEqualToString:@"typing"])
+            [sizes addObject:[NSNumber numberWithInt:[argument intValue]]];
+        
+        else
+        {
+            CPPrintUsage();
+            [pool release];
+            return 1;
+        }
+    }
+    
+    if ([mode isEqualToString:@"replace"])
+    {
+        succeeded = CPBenchmarkReplaceAll(editCount, compare);
+        
+        [pool release];
+        
+        return (succeeded) ? 0 : 2;
+    }
+    
+    if ([mode isEqualToString:@"typing"])
+    {
+        succeeded = CPBenchmarkTyping(editCount);
+        
+        [pool release];
+        
+        return (succeeded) ? 0 : 2;
+    }
+    
+    if ([sizes count] == 0)
+    {
+        if ([mode isEqualToString:@"load"] || [mode isEqualToString:@"statistics"])
+        {
+            [sizes addObject:[NSNumber numberWithInt:1]];
+            [sizes addObject:[NSNumber numberWithInt:10]];
+        }
+        
+        else if ([mode isEqualToString:@"attachments"])
+        {
+            [sizes addObject:[NSNumber numberWithInt:10]];
+            [sizes addObject:[NSNumber numberWithInt:100]];
+            [sizes addObject:[NSNumber numberWithInt:1000]];
+            [sizes addObject:[NSNumber numberWithInt:10000]];
+        }
+        
+        else
+        {
+            [sizes addObject:[NSNumber numberWithInt:10]];
+            [sizes addObject:[NSNumber numberWithInt:100]];
+            [sizes addObject:[NSNumber numberWithInt:1024]];
+        }
+    }
+    
+    list = [sizes objectEnumerator];
+    
+    while (size = [list nextObject])
+    {
+        BOOL sizeSucceeded;
+        
+        if ([mode isEqualToString:@"load"])
+            sizeSucceeded = CPBenchmarkLoad(folder, [size unsignedIntValue]);
+        
+        else if ([mode isEqualToString:@"attachments"])
+            sizeSucceeded = CPBenchmarkAttachments([size unsignedIntValue]);
+        
+        else if ([mode isEqualToString:@"statistics"])
+            sizeSucceeded = CPBenchmarkStatistics(folder, [size unsignedIntValue], editCount);
+        
+        else
+            sizeSucceeded = CPBenchmarkEdits(folder, [size unsignedIntValue], editCount, compare);
+        
+        if (!sizeSucceeded)
+            succeeded = NO;
+    }
+    
+    [pool release];
+    
+    return (succeeded) ? 0 : 2;
+}
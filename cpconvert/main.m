@@ -0,0 +1,445 @@
+/*
+ ---------------------------------------------------------------------------
+ CocoaPad -- cpconvert/main.m
+ By Henry Weiss
+ ---------------------------------------------------------------------------
+ cpconvert converts documents between CPD, RTF, RTFD, Word, and plain text
+ without opening any windows.  It uses the same CPDocumentCodec that
+ CocoaPad uses to open and save documents, so the files come out exactly
+ the way CocoaPad would have saved them.
+ 
+ Usage: cpconvert -to <cpd|rtf|rtfd|doc|txt> [-o <folder>] [-j <threads>]
+                  <file or folder> ...
+ 
+ Folders are searched (including subfolders) for anything with one of
+ CocoaPad's extensions.  Each file is converted by a CPWorkerPool thread
+ (one per processor unless -j says otherwise, up to 64), written to disk, and let go
+ of before the thread moves on, so only a few documents are in memory at a
+ time.  Converted files go next to the originals, or into the -o folder.
+ Files found in a folder keep their place under it there (so dir/a/x.rtf
+ goes to <folder>/dir/a/x.<ext>).  If two files would end up with the same
+ name, nothing is converted.
+ 
+ There's no nib and no NSApplication, so it runs on a headless box too
+ (see the GNUmakefile for building with GNUstep).  Word files can only be
+ read and written where the text system supports them (Mac OS X 10.3 and
+ up).
+ 
+ Major events:
+ 
+ - 10/17/26: Created.
+ - 10/17/26: -j has to be at least 1, and more than 64 threads are cut
+             down to 64.  File sizes come from CPDocumentCodec.
+ - 10/17/26: Files keep their folders under -o instead of all landing in
+             it by name (two files with the same name used to overwrite
+             each other), and names that would still collide are caught
+             before anything is converted.  RTFD packages are read mapped,
+             like CocoaPad does.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+#import "CPDocumentCodec.h"
+#import "CPWorkerPool.h"
+
+// For printf() and atoi()
+#import <stdio.h>
+#import <stdlib.h>
+
+/*************/
+/* Constants */
+/*************/
+
+#define CP_MaxThreadCount 64  // More than that just fights over the disk
+
+// Keys in each file's job
+
+static NSString *CP_InputPathKey = @"InputPath";
+static NSString *CP_RelativePathKey = @"RelativePath";  // Where it goes under the -o folder
+static NSString *CP_OutputPathKey = @"OutputPath";
+
+// Keys in each file's results
+
+static NSString *CP_InputSizeKey = @"InputSize";
+static NSString *CP_OutputSizeKey = @"OutputSize";
+static NSString *CP_SucceededKey = @"Succeeded";
+
+/**********************************/
+/* Instance variables and Methods */
+/**********************************/
+
+// Converts one file at a time (on a worker thread)
+
+@interface CPConverter : NSObject
+{
+    CPDocumentFormat outputFormat;
+    NSLock *outputLock;  // So lines from different threads don't get mixed up
+}
+
+- (id)initWithFormat:(CPDocumentFormat)format;
+- (id)convertFile:(NSDictionary *)job;
+
+@end
+
+
+@implementation CPConverter
+
+- (id)initWithFormat:(CPDocumentFormat)format
+{
+    if (self = [super init])
+    {
+        outputFormat = format;
+        outputLock = [[NSLock alloc] init];
+    }
+    
+    return self;
+}
+
+/***** Convert a file (this is the worker pool task) *****/
+
+// main() has already worked out where it goes (and made its folder)
+
+- (id)convertFile:(NSDictionary *)job
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSDate *start = [NSDate date];
+    NSString *path = [job objectForKey:CP_InputPathKey];
+    NSString *outputPath = [job objectForKey:CP_OutputPathKey];
+    CPDocumentFormat inputFormat = [CPDocumentCodec formatForPathExtension:[path pathExtension]];
+    NSAttributedString *text = nil;
+    NSFileWrapper *output = nil;
+    unsigned inputSize = 0, outputSize = 0;
+    BOOL succeeded = NO;
+    NSTimeInterval time;
+    NSDictionary *result;
+    
+    // Read it the way CocoaPad opens it (mapped, so big files only get paged in as they're read)...
+    
+    if (inputFormat == CPFormatRTFD)
+    {
+        NSFileWrapper *input = [CPDocumentCodec fileWrapperWithContentsOfPath:path];
+        
+        if (input != nil)
+        {
+            inputSize = [CPDocumentCodec sizeOfFileWrapper:input];
+            text = [CPDocumentCodec textFromFileWrapper:input format:inputFormat];
+        }
+    }
+    
+    else
+    {
+        NSData *input = [NSData dataWithContentsOfMappedFile:path];
+        
+        if (input != nil)
+        {
+            inputSize = [input length];
+            text = [CPDocumentCodec textFromData:input format:inputFormat];
+        }
+    }
+    
+    // ...and write it the way CocoaPad saves it
+    
+    if (text != nil)
+    {
+        output = [CPDocumentCodec fileWrapperFromText:text format:outputFormat];
+    }
+    
+    if (output != nil && ![outputPath isEqualToString:path])
+    {
+        [[NSFileManager defaultManager] removeFileAtPath:outputPath handler:nil];  // RTFD folders don't get replaced
+        
+        if ([output writeToFile:outputPath atomically:YES updateFilenames:NO])
+        {
+            outputSize = [CPDocumentCodec sizeOfFileWrapper:output];
+            succeeded = YES;
+        }
+    }
+    
+    time = -[start timeIntervalSinceNow];
+    
+    [outputLock lock];
+    
+    if (succeeded)
+        printf("%s -> %s: %u bytes in %.3f sec (%.2f MB/s)\n", [path fileSystemRepresentation], [outputPath fileSystemRepresentation], inputSize, time, (time > 0.0) ? (inputSize / 1048576.0) / time : 0.0);
+    
+    else
+        printf("%s: could not be converted\n", [path fileSystemRepresentation]);
+    
+    fflush(stdout);
+    
+    [outputLock unlock];
+    
+    result = [[NSDictionary alloc] initWithObjectsAndKeys:
+        [NSNumber numberWithUnsignedInt:inputSize], CP_InputSizeKey,
+        [NSNumber numberWithUnsignedInt:outputSize], CP_OutputSizeKey,
+        [NSNumber numberWithBool:succeeded], CP_SucceededKey,
+        nil];
+    
+    [pool release];  // Everything we read and wrote goes away here
+    
+    return [result autorelease];
+}
+
+/***** Override the dealloc method so we can release our own objects *****/
+
+- (void)dealloc
+{
+    [outputLock release];
+    
+    [super dealloc];  // ...we now return to the previously scheduled deallocation.
+}
+
+@end
+
+/*************/
+/* Functions */
+/*************/
+
+/***** Print how to use it *****/
+
+static void CPPrintUsage(void)
+{
+    fprintf(stderr, "usage: cpconvert -to <cpd|rtf|rtfd|doc|txt> [-o <folder>] [-j <threads>] <file or folder> ...\n");
+}
+
+/***** Find every document in a folder (or just the file itself) *****/
+
+// Each one is added as a job, with where it goes under the -o folder
+
+static void CPAddFile(NSString *path, NSString *relativePath, NSMutableArray *files)
+{
+    [files addObject:[NSMutableDictionary dictionaryWithObjectsAndKeys:
+        path, CP_InputPathKey,
+        relativePath, CP_RelativePathKey,
+        nil]];
+}
+
+static void CPAddFiles(NSString *path, NSMutableArray *files)
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    NSDirectoryEnumerator *folder;
+    NSString *file;
+    BOOL isFolder;
+    
+    if (![fileManager fileExistsAtPath:path isDirectory:&isFolder])
+    {
+        fprintf(stderr, "cpconvert: %s doesn't exist\n", [path fileSystemRepresentation]);
+        return;
+    }
+    
+    // RTFD documents are folders too
+    
+    if (!isFolder || [CPDocumentCodec formatForPathExtension:[path pathExtension]] == CPFormatRTFD)
+    {
+        CPAddFile(path, [path lastPathComponent], files);
+        return;
+    }
+    
+    folder = [fileManager enumeratorAtPath:path];
+    
+    while (file = [folder nextObject])
+    {
+        CPDocumentFormat format = [CPDocumentCodec formatForPathExtension:[file pathExtension]];
+        
+        if (format == CPFormatRTFD)
+            [folder skipDescendents];  // Don't look inside
+        
+        if (format != CPFormatUnknown && ![[file lastPathComponent] hasPrefix:@"."])
+            CPAddFile([path stringByAppendingPathComponent:file], [[[path stringByStandardizingPath] lastPathComponent] stringByAppendingPathComponent:file], files);
+    }
+}
+
+/***** Make a folder, and any folders it's in that aren't there yet *****/
+
+static BOOL CPCreateFolder(NSString *path)
+{
+    NSFileManager *fileManager = [NSFileManager defaultManager];
+    BOOL isFolder;
+    
+    if ([path length] == 0)
+        return YES;  // The current folder
+    
+    if ([fileManager fileExistsAtPath:path isDirectory:&isFolder])
+        return isFolder;
+    
+    if (!CPCreateFolder([path stringByDeletingLastPathComponent]))
+        return NO;
+    
+    return [fileManager createDirectoryAtPath:path attributes:nil];
+}
+
+/***** Work out where every file goes *****/
+
+/*
+ * Returns NO if two files would be written to the same place (or
+ * a folder can't be made), after saying which ones.  The folders
+ * are made here, before any threads get going.
+ */
+
+static BOOL CPSetOutputPaths(NSArray *files, CPDocumentFormat format, NSString *outputFolder)
+{
+    NSMutableDictionary *outputs = [NSMutableDictionary dictionary];  // Output path -> input path
+    NSString *extension = [CPDocumentCodec pathExtensionForFormat:format];
+    NSEnumerator *list = [files objectEnumerator];
+    NSMutableDictionary *job;
+    BOOL succeeded = YES;
+    
+    while (job = [list nextObject])
+    {
+        NSString *path = [job objectForKey:CP_InputPathKey];
+        NSString *outputPath = (outputFolder != nil) ? [outputFolder stringByAppendingPathComponent:[job objectForKey:CP_RelativePathKey]] : path;
+        NSString *key, *other;
+        
+        outputPath = [[outputPath stringByDeletingPathExtension] stringByAppendingPathExtension:extension];
+        key = [outputPath stringByStandardizingPath];
+        other = [outputs objectForKey:key];
+        
+        if (other != nil)
+        {
+            fprintf(stderr, "cpconvert: %s and %s would both be written to %s\n", [other fileSystemRepresentation], [path fileSystemRepresentation], [outputPath fileSystemRepresentation]);
+            succeeded = NO;
+            continue;
+        }
+        
+        [outputs setObject:path forKey:key];
+        [job setObject:outputPath forKey:CP_OutputPathKey];
+        
+        if (!CPCreateFolder([outputPath stringByDeletingLastPathComponent]))
+        {
+            fprintf(stderr, "cpconvert: couldn't make the folder for %s\n", [outputPath fileSystemRepresentation]);
+            succeeded = NO;
+        }
+    }
+    
+    return succeeded;
+}
+
+/***** Main *****/
+
+int main(int argc, const char *argv[])
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray *files = [NSMutableArray array];
+    NSMutableArray *tasks = [NSMutableArray array];
+    CPDocumentFormat format = CPFormatUnknown;
+    NSString *outputFolder = nil;
+    unsigned threads = [CPWorkerPool processorCount];
+    unsigned long long inputSize = 0, outputSize = 0;
+    unsigned converted = 0, failed = 0;
+    CPWorkerPool *workerPool;
+    CPConverter *converter;
+    NSEnumerator *list;
+    NSDictionary *file;
+    CPWorkerTask *task;
+    NSDate *start;
+    NSTimeInterval time;
+    int i;
+    
+    // Read the arguments
+    
+    for (i = 1; i < argc; i++)
+    {
+        NSString *argument = [NSString stringWithUTF8String:argv[i]];
+        
+        if ([argument isEqualToString:@"-to"] && i + 1 < argc)
+            format = [CPDocumentCodec formatForPathExtension:[NSString stringWithUTF8String:argv[++i]]];
+        
+        else if ([argument isEqualToString:@"-o"] && i + 1 < argc)
+            outputFolder = [NSString stringWithUTF8String:argv[++i]];
+        
+        else if ([argument isEqualToString:@"-j"] && i + 1 < argc)
+        {
+            int count = atoi(argv[++i]);
+            
+            if (count < 1)
+            {
+                fprintf(stderr, "cpconvert: -j needs at least 1 thread\n");
+                [pool release];
+                return 1;
+            }
+            
+            if (count > CP_MaxThreadCount)
+            {
+                fprintf(stderr, "cpconvert: using %d threads instead of %d\n", CP_MaxThreadCount, count);
+                count = CP_MaxThreadCount;
+            }
+            
+            threads = count;
+        }
+        
+        else
+            CPAddFiles(argument, files);
+    }
+    
+    if (format == CPFormatUnknown || [files count] == 0 || threads == 0)
+    {
+        CPPrintUsage();
+        [pool release];
+        return 1;
+    }
+    
+    if (format == CPFormatWord && ![CPDocumentCodec supportsWordFormat])
+    {
+        fprintf(stderr, "cpconvert: Word files aren't supported here\n");
+        [pool release];
+        return 1;
+    }
+    
+    if (!CPSetOutputPaths(files, format, outputFolder))
+    {
+        [pool release];
+        return 1;
+    }
+    
+    // Hand all of the files to the pool, and wait for them
+    
+    workerPool = [[CPWorkerPool alloc] initWithThreadCount:threads];
+    converter = [[CPConverter alloc] initWithFormat:format];
+    start = [NSDate date];
+    
+    list = [files objectEnumerator];
+    
+    while (file = [list nextObject])
+    {
+        [tasks addObject:[workerPool addTaskWithTarget:converter selector:@selector(convertFile:) object:file]];
+    }
+    
+    [workerPool waitUntilIdle];
+    
+    time = -[start timeIntervalSinceNow];
+    
+    // Add everything up
+    
+    list = [tasks objectEnumerator];
+    
+    while (task = [list nextObject])
+    {
+        NSDictionary *result = [task result];
+        
+        if ([[result objectForKey:CP_SucceededKey] boolValue])
+        {
+            inputSize += [[result objectForKey:CP_InputSizeKey] unsignedIntValue];
+            outputSize += [[result objectForKey:CP_OutputSizeKey] unsignedIntValue];
+            converted++;
+        }
+        
+        else
+        {
+            failed++;
+        }
+    }
+    
+    printf("\n%u file(s) converted, %u failed, with %u thread(s)\n", converted, failed, threads);
+    printf("%qu bytes read, %qu bytes written in %.3f sec\n", inputSize, outputSize, time);
+    
+    if (time > 0.0)
+        printf("%.2f MB/s, %.1f files/s\n", (inputSize / 1048576.0) / time, converted / time);
+    
+    [converter release];
+    
+    // The worker threads never finish, so we don't release the pool
+    
+    [pool release];
+    
+    return (failed > 0) ? 2 : 0;
+}